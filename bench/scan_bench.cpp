@@ -0,0 +1,100 @@
+// Compares the boundary scan in the telnet input path: the old two-pass std::find approach
+// (IAC over the inbox, then LF over each data run) against scan::findSpecial.
+
+#include "mudlink/scan.hpp"
+#include "mudlink/telnet.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+
+using namespace mudlink;
+
+namespace {
+
+    std::string makeInput(std::size_t size) {
+        // Mostly pasted command lines, with the odd bit of negotiation mixed in.
+        std::mt19937 rng(42);
+        std::uniform_int_distribution<int> len(8, 120), chr('a', 'z'), neg(0, 63);
+        std::string out;
+        while(out.size() < size) {
+            auto n = len(rng);
+            for(int i = 0; i < n; i++) out.push_back(i % 7 ? (char)chr(rng) : ' ');
+            out.append("\r\n");
+            if(!neg(rng)) out.append("\xff\xfb\x1f");
+        }
+        return out;
+    }
+
+    std::size_t twoPass(std::string_view buf) {
+        std::size_t lines = 0;
+        auto pos = buf.begin();
+        while(pos != buf.end()) {
+            if((uint8_t)*pos == telnet::IAC) {
+                pos += 3;
+                continue;
+            }
+            auto run_end = std::find(pos, buf.end(), (char)telnet::IAC);
+            auto check = pos;
+            while((check = std::find(check, run_end, (char)telnet::LF)) != run_end) {
+                check++;
+                lines++;
+            }
+            pos = run_end;
+        }
+        return lines;
+    }
+
+    template<typename F>
+    std::size_t onePass(std::string_view buf, F &&find) {
+        std::size_t lines = 0, pos = 0;
+        while(pos < buf.size()) {
+            pos += find(buf.substr(pos));
+            if(pos == buf.size()) break;
+            switch((uint8_t)buf[pos]) {
+                case telnet::IAC:
+                    pos += 3;
+                    break;
+                case telnet::LF:
+                    lines++;
+                    [[fallthrough]];
+                default:
+                    pos++;
+                    break;
+            }
+        }
+        return lines;
+    }
+
+    std::size_t parser(std::string_view buf) {
+        std::size_t lines = 0;
+        telnet::TelnetMessage::parse_bytes(buf, [&](telnet::TelnetMessage &msg) {
+            if(msg.mtype == telnet::MessageType::Data && msg.data.back() == '\n') lines++;
+        });
+        return lines;
+    }
+
+    template<typename F>
+    void run(const char *name, std::string_view buf, F &&fn) {
+        constexpr int rounds = 50;
+        std::size_t lines = 0;
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < rounds; i++) lines += fn(buf);
+        std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+        auto mbps = (double)buf.size() * rounds / took.count() / (1024.0 * 1024.0);
+        std::printf("%-24s %10.1f MiB/s  (%zu lines)\n", name, mbps, lines / rounds);
+    }
+
+}
+
+int main() {
+    auto input = makeInput(16 * 1024 * 1024);
+    std::string_view buf(input);
+    std::printf("kernel: %s, input: %zu bytes\n", scan::kernelName(), input.size());
+    run("two-pass std::find", buf, twoPass);
+    run("findSpecialScalar", buf, [](std::string_view b) { return onePass(b, scan::findSpecialScalar); });
+    run("findSpecial", buf, [](std::string_view b) { return onePass(b, scan::findSpecial); });
+    run("TelnetMessage parser", buf, parser);
+    return 0;
+}
@@ -0,0 +1,40 @@
+#ifndef MUDLINK_COLOR_H
+#define MUDLINK_COLOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "mudlink/mudconn.hpp"
+
+namespace mudlink {
+
+    // Text from the game carries its colour as ANSI SGR sequences at whatever depth it likes:
+    // the 16 ANSI colours, the xterm-256 palette (ESC[38;5;Nm) or 24-bit (ESC[38;2;R;G;Bm).
+    // Each client gets it rendered down to what it can show.
+
+    // The nearest colour of the xterm-256 palette (outside the 16 terminals redefine) to an RGB one.
+    uint8_t xtermFromRgb(uint8_t r, uint8_t g, uint8_t b);
+    // The nearest of the 16 ANSI colours to an xterm-256 one.
+    uint8_t ansiFromXterm(uint8_t index);
+
+    // Rewrites text for a client of the given colour depth: 24-bit colours become xterm-256 ones
+    // for Xterm, every colour becomes one of the 16 for Ansi, and every escape sequence is removed
+    // for None. Non-ASCII is folded to one ? per character unless utf8. Returns false, leaving
+    // out alone, if text needs no changes.
+    bool renderColor(std::string_view text, MudColor color, bool utf8, std::string &out);
+
+    // Keeps the result of renderText alive.
+    struct RenderScratch {
+        std::string local;
+        SharedBuffer cached;
+    };
+
+    // renderColor, with longer texts going through a small per-thread LRU cache keyed by the text's
+    // hash, colour depth and utf8, so a room description sent to many clients is rendered once per
+    // kind of client. Returns text itself if it needs no changes, or a view into scratch.
+    std::string_view renderText(std::string_view text, MudColor color, bool utf8, RenderScratch &scratch);
+
+}
+
+#endif //MUDLINK_COLOR_H
@@ -0,0 +1,34 @@
+#ifndef MUDLINK_INBUFFER_H
+#define MUDLINK_INBUFFER_H
+
+#include <cstddef>
+#include <boost/asio/buffer.hpp>
+
+namespace mudlink {
+
+    // Bytes read from a connection that haven't been parsed yet, in one contiguous run. The
+    // memory comes from BufferPool and goes back the moment everything has been consumed, so a
+    // connection only holds a buffer while it has input in hand.
+    class InputBuffer {
+    public:
+        InputBuffer() = default;
+        ~InputBuffer();
+        InputBuffer(const InputBuffer &) = delete;
+        InputBuffer& operator=(const InputBuffer &) = delete;
+        // Space for len more bytes on the end, to be kept with commit().
+        boost::asio::mutable_buffer prepare(std::size_t len);
+        void commit(std::size_t len);
+        // Everything committed and not yet consumed.
+        [[nodiscard]] boost::asio::const_buffer data() const;
+        void consume(std::size_t len);
+        [[nodiscard]] std::size_t size() const;
+        [[nodiscard]] std::size_t capacity() const;
+    private:
+        void release();
+        char *block = nullptr;
+        std::size_t cap = 0, begin = 0, end = 0;
+    };
+
+}
+
+#endif //MUDLINK_INBUFFER_H
@@ -0,0 +1,53 @@
+#ifndef MUDLINK_IOPOOL_H
+#define MUDLINK_IOPOOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/executor_work_guard.hpp>
+#include "mudlink/timerwheel.hpp"
+
+namespace mudlink {
+
+    // A set of io_contexts, one per thread. Connections are dealt out round-robin and stay on
+    // their context for life, each on its own strand. Until start() is called everything runs
+    // on the fallback context, as it always has. Every context has a TimerWheel for the
+    // connections on it.
+    class IoPool {
+    public:
+        explicit IoPool(boost::asio::io_context &fallback);
+        ~IoPool();
+        // Spins up count threads (0 = one per core). Does nothing if already started.
+        void start(std::size_t count);
+        // Stops every context and joins the threads. The contexts themselves are kept, so sockets
+        // that belong to them can still be destroyed safely.
+        void join();
+        // As join(), then destroys the contexts along with any handlers still queued on them.
+        void stop();
+        // The context the next connection should live on.
+        boost::asio::io_context& next();
+        boost::asio::io_context& get(std::size_t index);
+        [[nodiscard]] std::size_t size() const;
+        // Whether ctx is one of the pool's own contexts.
+        [[nodiscard]] bool owns(const boost::asio::execution_context &ctx) const;
+        // The wheel for ctx, which must be the fallback or one of the pool's contexts.
+        TimerWheel& wheel(const boost::asio::execution_context &ctx);
+    private:
+        using WorkGuard = boost::asio::executor_work_guard<boost::asio::io_context::executor_type>;
+        boost::asio::io_context &fallback;
+        std::vector<std::unique_ptr<boost::asio::io_context>> contexts;
+        // wheels[i] runs on contexts[i]. They outlive the contexts, so connections destroyed along
+        // with a context can still cancel their timers.
+        TimerWheel fallback_wheel;
+        std::vector<std::unique_ptr<TimerWheel>> wheels;
+        std::vector<WorkGuard> guards;
+        std::vector<std::thread> threads;
+        std::atomic<std::size_t> cursor{0};
+    };
+
+}
+
+#endif //MUDLINK_IOPOOL_H
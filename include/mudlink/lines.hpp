@@ -0,0 +1,73 @@
+#ifndef MUDLINK_LINES_H
+#define MUDLINK_LINES_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+namespace mudlink {
+
+    // Trims leading and trailing whitespace (including the CR/LF and telnet NUL padding) without copying.
+    std::string_view trimLine(std::string_view line);
+
+    // Assembles incoming bytes into command lines. Complete lines are handed to a callback as
+    // trimmed views, which are only valid for the duration of the call. Only a partial line is
+    // ever buffered, and it is capped at max_length bytes; anything past that is dropped up to
+    // the next LF, so one client can't grow the buffer without bound.
+    struct LineAssembler {
+        explicit LineAssembler(std::size_t max_length = 4096);
+
+        // Feeds a run of bytes that holds at most one LF, as its last byte. The telnet parser
+        // already splits data this way, so no second scan is needed. When nothing is buffered
+        // a complete run is handed straight through without being copied.
+        template<typename F>
+        void push(std::string_view run, F &&cb) {
+            if(run.empty()) return;
+            bool complete = run.back() == '\n';
+            if(complete && buf.empty() && !overflowed) {
+                cb(trimLine(run.substr(0, std::min(run.size(), max_length))));
+                return;
+            }
+            if(!overflowed) {
+                auto room = max_length - buf.size();
+                if(run.size() > room) {
+                    buf.append(run.substr(0, room));
+                    overflowed = true;
+                } else {
+                    buf.append(run);
+                }
+            }
+            if(complete) {
+                cb(trimLine(buf));
+                reset();
+            }
+        }
+
+        // Feeds arbitrary bytes, splitting them at each LF.
+        template<typename F>
+        void feed(std::string_view data, F &&cb) {
+            while(!data.empty()) {
+                auto lf = static_cast<const char*>(std::memchr(data.data(), '\n', data.size()));
+                auto len = lf ? (std::size_t)(lf - data.data()) + 1 : data.size();
+                push(data.substr(0, len), cb);
+                data.remove_prefix(len);
+            }
+        }
+
+        // Bytes of the current partial line held in the buffer.
+        [[nodiscard]] std::size_t pending() const;
+        // Drops any partial line.
+        void reset();
+
+        std::size_t max_length;
+        // Set while the tail of an over-long line is being discarded.
+        bool overflowed = false;
+    private:
+        std::string buf;
+    };
+
+}
+
+#endif //MUDLINK_LINES_H
@@ -0,0 +1,109 @@
+#ifndef MUDLINK_MCCP_H
+#define MUDLINK_MCCP_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <string_view>
+#include <zlib.h>
+#include "mudlink/outqueue.hpp"
+#include "mudlink/inbuffer.hpp"
+
+namespace mudlink {
+
+    struct CompressionConfig {
+        bool enabled = true;
+        // zlib level (0-9), window bits (9-15) and memLevel (1-9). Window and memLevel are
+        // lowered as needed to fit max_memory.
+        int level = 6, window_bits = 15, mem_level = 8;
+        // Most memory one connection's compressor may hold.
+        std::size_t max_memory = 256 * 1024;
+        // Flushes smaller than this go out as stored (uncompressed) deflate blocks, which costs
+        // a few bytes of framing but no compression CPU.
+        std::size_t min_flush = 64;
+        // An inbound (MCCP3) stream may inflate to at most max_ratio times its compressed size,
+        // once past the first ratio_grace bytes. Anything more is treated as a decompression bomb.
+        std::size_t max_ratio = 100, ratio_grace = 64 * 1024;
+    };
+
+    // Memory held by all compressors, against a global limit. Shared by every connection.
+    struct CompressionBudget {
+        std::size_t limit = 256 * 1024 * 1024;
+        std::atomic<std::size_t> used{0};
+    };
+
+    // Running totals for one of a connection's compressed streams. Written by the I/O thread, safe to
+    // read from anywhere.
+    struct CompressionStats {
+        std::atomic<uint64_t> bytes_in{0}, bytes_out{0}, cpu_ns{0};
+        // Compressed size as a fraction of the input; 1.0 until something has been compressed.
+        [[nodiscard]] double ratio() const;
+    };
+
+    // What a zlib stream of either direction shares: its memory accounting against the
+    // per-connection and global limits.
+    class ZlibStream {
+    public:
+        ZlibStream(const ZlibStream &) = delete;
+        ZlibStream& operator=(const ZlibStream &) = delete;
+        // Memory this stream currently holds.
+        [[nodiscard]] std::size_t memory() const;
+    protected:
+        ZlibStream(const CompressionConfig &cfg, CompressionBudget &budget, CompressionStats &stats);
+        ~ZlibStream();
+        // Accounts for bytes zlib will only allocate later, so that running out shows up now.
+        // The next allocations that fit are taken from the reservation.
+        bool reserve(std::size_t bytes);
+        static voidpf alloc(voidpf opaque, uInt items, uInt size);
+        static void release(voidpf opaque, voidpf ptr);
+        const CompressionConfig &config;
+        CompressionBudget &budget;
+        CompressionStats &stats;
+        z_stream zs{};
+        bool started = false;
+        std::size_t used = 0, reserved = 0;
+    };
+
+    // A zlib deflate stream over a connection's output, as used by MCCP2.
+    class Compressor : public ZlibStream {
+    public:
+        Compressor(const CompressionConfig &cfg, CompressionBudget &budget, CompressionStats &stats);
+        ~Compressor();
+        // Sets up the stream. Returns false if it wouldn't fit in the memory limits.
+        bool start();
+        // Drains in, compressing it onto the end of out and sync-flushing so the client can
+        // decode everything sent so far. With finish, the stream is ended instead.
+        void compress(OutputQueue &in, OutputQueue &out, bool finish = false);
+    private:
+        void deflateInto(OutputQueue &out, const char *data, std::size_t len, int flush);
+        std::vector<boost::asio::const_buffer> scratch;
+        int level;
+    };
+
+    enum class InflateStatus : uint8_t {
+        // All input was inflated; more may follow.
+        Ok = 0,
+        // The client ended the stream. Whatever input is left is uncompressed.
+        Finished = 1,
+        // Corrupt data, or it expanded past CompressionConfig::max_ratio.
+        Failed = 2,
+        // zlib couldn't get the memory it needed.
+        OutOfMemory = 3
+    };
+
+    // A zlib inflate stream over a connection's input, as used by MCCP3.
+    class Decompressor : public ZlibStream {
+    public:
+        Decompressor(const CompressionConfig &cfg, CompressionBudget &budget, CompressionStats &stats);
+        ~Decompressor();
+        // Sets up the stream, window included. Returns false if it wouldn't fit in the memory limits.
+        bool start();
+        // Inflates the front of in straight into out, removing whatever it used from in.
+        InflateStatus decompress(std::string_view &in, InputBuffer &out);
+    };
+
+}
+
+#endif //MUDLINK_MCCP_H
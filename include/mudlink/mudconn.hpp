@@ -15,10 +15,22 @@
 #include <iostream>
 #include <unordered_map>
 #include <unordered_set>
-#include <any>
 #include <deque>
+#include <functional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <variant>
+#include <vector>
 #include <thread>
 #include <mutex>
+#include "mudlink/pool.hpp"
+#include "mudlink/inbuffer.hpp"
+#include "mudlink/ring.hpp"
+#include "mudlink/iopool.hpp"
+#include "mudlink/outqueue.hpp"
+#include "mudlink/mccp.hpp"
 
 namespace mudlink {
     using TcpSocket = boost::asio::ip::tcp::socket;
@@ -31,12 +43,13 @@ namespace mudlink {
         WebSocket = 1
     };
 
-    union MudConn {
-        TcpSocket* peer;
-        TlsSocket* secure_peer;
-        TcpWebSocket* websocket;
-        TlsWebSocket* tls_websocket;
-    };
+    // The stream a connection talks over. It starts out as the accepted TcpSocket, which is moved
+    // into a TLS and/or WebSocket wrapper in place as those are layered on.
+    using Transport = std::variant<TcpSocket, TlsSocket, TcpWebSocket, TlsWebSocket>;
+
+    // Transports that carry a raw byte stream (telnet) rather than WebSocket messages.
+    template<typename S>
+    constexpr bool isByteStream = std::is_same_v<S, TcpSocket> || std::is_same_v<S, TlsSocket>;
 
     enum MudColor : uint8_t {
         None = 0,
@@ -49,14 +62,48 @@ namespace mudlink {
         Command = 0,
         OOB = 1,
         StatusReq = 2,
+        // The client's capabilities have changed since Ready. At most one per batch of input.
         Update = 3,
         Disconnected = 4,
-        Ready = 5
+        Ready = 5,
+        // The connection has sent nothing for ConnTimers::afk. Its next command means it is back.
+        Afk = 6
+    };
+
+    // An out-of-band message: a package (GMCP) or variable (MSDP) name and its payload, kept
+    // together in one buffer so a short message costs a single allocation at most.
+    struct OobMessage {
+        OobMessage() = default;
+        OobMessage(std::string_view package, std::string_view payload);
+        [[nodiscard]] std::string_view package() const;
+        [[nodiscard]] std::string_view payload() const;
+        std::string raw;
+        uint32_t split = 0;
     };
 
+    // MSSP variables, in the order they should be reported.
+    using MsspData = std::vector<std::pair<std::string, std::string>>;
+
+    struct Capabilities;
+    using SharedCapabilities = std::shared_ptr<const Capabilities>;
+
+    // The payload of an event. Which alternative is used depends on the event type: text for
+    // commands and output, OobMessage for OOB traffic, MsspData for MSSP, a snapshot of the
+    // client's Capabilities for Ready and Update, nothing for the rest.
+    // Output events may instead carry a SharedBuffer of bytes already encoded for the
+    // connection's protocol, which is queued as-is and can be shared by many connections.
+    using EventData =
+            std::variant<std::monostate, std::string, OobMessage, MsspData, SharedBuffer, SharedCapabilities>;
+
+    // Events are move-only; they are handed from one side to the other, never shared.
     struct MsgToMud {
+        explicit MsgToMud(ToMudEvent mt, EventData d = {});
+        MsgToMud(MsgToMud &&) = default;
+        MsgToMud& operator=(MsgToMud &&) = default;
+        MsgToMud(const MsgToMud &) = delete;
+        MsgToMud& operator=(const MsgToMud &) = delete;
         ToMudEvent mtype;
-        std::any data;
+        EventData data;
     };
 
     enum FromMudEvent : uint8_t {
@@ -66,58 +113,362 @@ namespace mudlink {
         OobData = 3,
         MSSP = 4,
         Disconnect = 5,
+        // Sets one of the connection's OOB variables: an OobMessage of its name (Package.key)
+        // and JSON value. Only changes reach the client, once per batch; see OobVars.
+        OobVar = 6
     };
 
     struct MsgFromMud {
+        explicit MsgFromMud(FromMudEvent mt, EventData d = {});
+        MsgFromMud(MsgFromMud &&) = default;
+        MsgFromMud& operator=(MsgFromMud &&) = default;
+        MsgFromMud(const MsgFromMud &) = delete;
+        MsgFromMud& operator=(const MsgFromMud &) = delete;
         FromMudEvent mtype;
-        std::any data;
+        EventData data;
     };
 
     struct Capabilities {
-        ProtocolType protocol;
+        ProtocolType protocol = Telnet;
         std::string client_name, client_version;
-        MudColor color;
-        bool utf8, mxp, oob, msdp, gmcp, mssp, mtts, naws, mccp2, sga = true, linemode = true;
-        bool screen_reader, vt100, mouse_tracking, osc_color_palette, mnes, proxy;
+        MudColor color = MudColor::None;
+        bool utf8 = false, mxp = false, oob = false, msdp = false, gmcp = false, mssp = false, mtts = false,
+            naws = false, mccp2 = false, mccp3 = false, sga = true, linemode = true;
+        bool screen_reader = false, vt100 = false, mouse_tracking = false, osc_color_palette = false,
+            mnes = false, proxy = false;
+        // From NAWS. Zero if the client hasn't said.
+        uint16_t width = 0, height = 0;
+    };
+
+    // How a prompt is terminated on the wire.
+    enum PromptEnd : uint8_t {
+        NoPromptEnd = 0,
+        PromptGA = 1,
+        PromptEOR = 2
+    };
+
+    // Which out-of-band protocol OOB events are sent with. GMCP is preferred if both are on.
+    enum OobMode : uint8_t {
+        NoOob = 0,
+        OobGMCP = 1,
+        OobMSDP = 2
+    };
+
+    // The parts of a connection's state that change how output is encoded. Connections with the
+    // same RenderClass get byte-for-byte identical bytes for the same event, so broadcasts only
+    // encode once per class. It packs into a byte for cheap comparison.
+    struct RenderClass {
+        ProtocolType protocol = Telnet;
+        MudColor color = MudColor::None;
+        bool utf8 = false;
+        PromptEnd prompt = NoPromptEnd;
+        OobMode oob = NoOob;
+        [[nodiscard]] uint8_t pack() const;
+        static RenderClass unpack(uint8_t key);
+    };
+
+    // Per-connection timers, all run off the I/O threads' TimerWheels. Zero turns one off. Set them
+    // before listening starts.
+    struct ConnTimers {
+        // A connection that sends nothing for this long is dropped.
+        std::chrono::milliseconds idle{0};
+        // One that has been sent nothing for this long gets a telnet NOP or WebSocket ping, to keep
+        // NAT and proxy state alive.
+        std::chrono::milliseconds keepalive{0};
+        // One that sends nothing for this long is reported to the game with an Afk event.
+        std::chrono::milliseconds afk{0};
+    };
+
+    // When queued output is written. Set it before listening starts.
+    struct FlushPolicy {
+        // TCP_NODELAY on every connection. Output is coalesced per batch already, so Nagle's
+        // algorithm would only hold back prompts.
+        bool nodelay = true;
+        // Holds TCP_CORK (Linux only) while a flush takes more than one write, such as a TLS
+        // flush over a record long, so it goes out in full segments. Released once it's all out.
+        bool cork = false;
+        // If set, a batch without a prompt may wait this long (rounded up to the timer wheel's
+        // tick) for later batches to join it. Prompts, and anything once max_pending bytes are
+        // buffered, go out at once.
+        std::chrono::milliseconds max_delay{0};
+        std::size_t max_pending = 16 * 1024;
+    };
+
+    // What happens to a connection whose client isn't reading its output fast enough. Flags.
+    enum OverflowPolicy : uint8_t {
+        // Line and Text events are dropped by ConnQueue::send. Prompts, OOB and the rest still go.
+        DropText = 1,
+        // OOB variables are held in the connection's table and only their latest values go out
+        // once it catches up.
+        CollapseOob = 2,
+        // The connection is dropped.
+        DisconnectSlow = 4
+    };
+
+    // Limits on output buffered for one connection: queued, or written to the socket and not yet
+    // taken by the kernel. Set them before listening starts.
+    struct Backpressure {
+        // A connection is backlogged from when it has high_watermark bytes buffered until it is
+        // back down to low_watermark, and policy applies while it is.
+        std::size_t high_watermark = 256 * 1024, low_watermark = 64 * 1024;
+        uint8_t policy = DropText | CollapseOob;
+        // Past this it is dropped, whatever the policy.
+        std::size_t max_buffered = 8 * 1024 * 1024;
+    };
+
+    // What became of an event handed to ConnQueue::send.
+    enum class SendStatus : uint8_t {
+        Queued,
+        // Queued, but the connection is backlogged.
+        Backlogged,
+        // Not queued: the connection is backlogged and the OverflowPolicy drops this kind of event.
+        Dropped,
+        // Not queued: the connection's event ring is full.
+        Full,
+        // No such connection.
+        NotFound
     };
 
     struct ConnQueue;
 
-    struct MudConnection {
-        explicit MudConnection(ConnQueue &cq, uint32_t id);
-        virtual ~MudConnection();
+    // An inbound event and the id of the connection it came from.
+    using InboundEvent = std::pair<uint32_t, MsgToMud>;
+
+    // Connections are owned by shared_ptr. The ConnQueue holds one reference while the connection is
+    // registered, and every pending handler holds another, so it lives until the last of them is done.
+    struct MudConnection : public std::enable_shared_from_this<MudConnection> {
+        // sock's executor is the strand every handler for this connection runs on.
+        MudConnection(ConnQueue &cq, uint32_t id, TcpSocket sock);
+        virtual ~MudConnection() = default;
         void onConnect();
         virtual void send();
+        // Waits for the socket to become readable, then reads. No buffer is held while waiting.
         virtual void receive();
+        // Reads whatever is available into inbox (or rawbox) and hands it to onReceive.
+        void readSome();
         virtual void onPlainConnect();
         virtual void onSecureConnect();
-        void sendToMud(MsgToMud &m);
+        // Queues an event for the game. Runs on the connection's I/O thread.
+        void sendToMud(MsgToMud &&m);
+        // Moves events that didn't fit in in_events into it, as far as there is room, and resumes
+        // reading once they all have.
+        void flushInbound();
+        // True, with reading paused, if events are still waiting for room in in_events. Overflow is
+        // then bounded by what one read can hold.
+        bool holdInput();
+        // Gives back in_events' storage if the game has drained it. Runs on the connection's I/O thread.
+        void trim();
+        // Puts the connection in the inbound ready set if it isn't there already.
+        void notifyInbound();
+        // Hands every event the game has queued for this connection to processFromMud.
+        // Runs on the connection's I/O thread.
+        void processOutbound();
         virtual void start() = 0;
         virtual void onReceive() = 0;
-        virtual void processFromMud(MsgFromMud &ev) = 0;
+        virtual void processFromMud(MsgFromMud &&ev) = 0;
+        // Queues whatever OOB variables changed during the batch just processed.
+        virtual void flushOob();
+        // Output bytes buffered and not yet taken by the kernel.
+        [[nodiscard]] virtual std::size_t bufferedBytes() const;
+        // Brings the ConnQueue's byte count and this connection's backlog state up to date after
+        // output was queued or written, and applies the OverflowPolicy.
+        void updateBacklog();
+        // Sends output held back under FlushPolicy::max_delay.
+        void flushDelayed();
+        void cork(bool on);
+        // Encodes the payload of ev as it would be sent to any connection of class rc, or returns
+        // null if it has no payload to encode. Must not touch per-connection state; it is called
+        // from the game thread on behalf of every connection in the class.
+        [[nodiscard]] virtual SharedBuffer encodeShared(const MsgFromMud &ev, RenderClass rc) const = 0;
+        // Works out this connection's render class and publishes it to render_class.
+        virtual void updateRenderClass();
         [[nodiscard]] bool isTLS() const;
+        // Compresses everything queued from now on through c, which must already be started.
+        void beginCompression(std::unique_ptr<Compressor> c);
+        // Ends the compressed stream after whatever is queued now.
+        void endCompression();
+        // Treats whatever is left in inbox, and everything read from now on, as compressed input
+        // for d, which must already be started. Returns false if the connection had to be dropped.
+        bool beginDecompression(std::unique_ptr<Decompressor> d);
+        // Inflates rawbox into inbox. Returns false if the connection had to be dropped.
+        bool inflateInbound();
+        // Closes the connection once everything queued for it so far has been written.
+        void shutdown();
+        // Closes the socket at once, cancelling anything in progress.
+        void close();
+        // Closes the connection at once, dropping unsent output, and tells the game why.
+        void abort(std::string_view reason);
+        // The TCP socket under whatever the transport currently is.
+        TcpSocket& socket();
+        // Sends something harmless that the client won't show, to keep an idle connection alive.
+        virtual void keepAlive();
+        // Acts on whichever of the ConnTimers are due, then arms activity_timer for the next.
+        void checkActivity();
+        void armActivity();
+        // Records that something was read, for the idle and AFK timers.
+        void noteInput();
         void onReady();
         Capabilities cap;
+        // RenderClass::pack() of this connection's render class, kept current by the I/O thread.
+        std::atomic<uint8_t> render_class{0};
         boost::asio::ssl::context* scon = nullptr;
-        bool isWriting = false, wsock = false, active = false;
+        // closing is set by shutdown(); closed once the socket has been closed.
+        bool isWriting = false, active = false, closing = false, closed = false;
         uint32_t conn_id;
         boost::asio::ip::address address;
         std::vector<MsgToMud> pending_events;
-        boost::asio::streambuf inbox, outbox;
-        std::deque<MsgFromMud> out_events;
-        std::deque<MsgToMud> in_events;
-        std::mutex in_mut, out_mut;
-        MudConn conn;
+        InputBuffer inbox;
+        // Compressed input waiting to be inflated into inbox, while a decompressor is active.
+        InputBuffer rawbox;
+        std::unique_ptr<Decompressor> decompressor;
+        CompressionStats decompress_stats;
+        // Output is queued in outbox. Each flush moves it to wirebox, compressing it on the way
+        // if a compressor is active, and writes go out from wirebox.
+        OutputQueue outbox, wirebox;
+        std::unique_ptr<Compressor> compressor;
+        CompressionStats compress_stats;
+        // Buffers for the write in progress, kept to reuse their capacity.
+        std::vector<boost::asio::const_buffer> write_bufs;
+        // Whether TCP_CORK is on, and whether flush_timer is waiting to send held-back output.
+        bool corked = false, delayed = false;
+        // Set by the I/O thread per Backpressure, read by ConnQueue::send.
+        std::atomic<bool> backlogged{false};
+        // bufferedBytes() as last added to ConnQueue::buffered_bytes.
+        std::size_t accounted = 0;
+        // Game thread -> I/O thread, and I/O thread -> game thread.
+        SpscRing<MsgFromMud> out_events;
+        SpscRing<MsgToMud> in_events;
+        // Inbound events that arrived while in_events was full. I/O thread only.
+        std::vector<MsgToMud> in_overflow;
+        // Set while the connection is waiting in the inbound ready set / has an outbound wakeup pending /
+        // has events waiting in in_overflow.
+        std::atomic<bool> in_flagged{false}, out_flagged{false}, in_stalled{false};
+        // Set when receive() held off reading because of in_overflow. I/O thread only.
+        bool read_paused = false;
         ConnQueue& cqueue;
+        boost::asio::any_io_executor exec;
+        // The timer wheel of the context exec runs on.
+        TimerWheel& wheel;
+        Transport transport;
+        // When anything was last read from / written to the connection, for the ConnTimers.
+        // Only the I/O thread touches them, and activity_timer just checks them when it comes up,
+        // so traffic never has to touch the wheel.
+        std::chrono::steady_clock::time_point last_input, last_output;
+        bool afk = false;
+        WheelTimer activity_timer;
+        WheelTimer flush_timer;
     };
 
+    // A WheelTimer callback that runs fn on the connection's strand, unless it has been closed by
+    // then. owner must be a C*. The wheel may call it while the connection is being destroyed on
+    // another thread, hence the weak reference.
+    template<typename C, void (C::*fn)()>
+    void onStrand(void *owner) {
+        auto self = static_cast<C*>(owner)->weak_from_this().lock();
+        if(!self) return;
+        auto exec = self->exec;
+        boost::asio::post(exec, [self = std::move(self)] {
+            auto conn = static_cast<C*>(self.get());
+            if(!conn->closed) (conn->*fn)();
+        });
+    }
+
+    // The hand-off point between the game thread and the I/O side. send() and processOutEvents()
+    // belong to the game thread; everything else is driven from the I/O side.
     struct ConnQueue {
-        explicit ConnQueue(boost::asio::io_context& con);
-        bool send(uint32_t id, MsgFromMud &ev);
+        explicit ConnQueue(boost::asio::io_context& con, std::size_t max_connections = 65536);
+        ~ConnQueue();
+        // Queues ev for a connection.
+        SendStatus send(uint32_t id, MsgFromMud &&ev);
+        // Wakes the I/O side for every connection that has been sent something since the last call.
         void processOutEvents();
-        std::mutex mut;
+        // Sends ev to every listed connection, encoding the payload once per render class and
+        // sharing the bytes between all recipients of that class. Returns how many it was queued for.
+        std::size_t broadcast(const std::vector<uint32_t> &ids, MsgFromMud &&ev);
+        // As above, for every connection for which pred(const MudConnection&) returns true.
+        template<typename F> requires std::is_invocable_r_v<bool, F, const MudConnection&>
+        std::size_t broadcast(F &&pred, MsgFromMud &&ev) {
+            std::size_t count = 0;
+            std::shared_lock lock(mut);
+            for(auto &[id, conn] : connections) {
+                if(pred(static_cast<const MudConnection&>(*conn)) && queued(queueShared(conn.get(), ev))) count++;
+            }
+            shared_cache.clear();
+            return count;
+        }
+        // Collects every queued MsgToMud from every connection with unread input into out, in one
+        // pass over the ready set. Each connection's events stay in order and idle connections are
+        // never visited. At most per_conn events are taken from any one connection; it stays ready
+        // and the rest are picked up by the next call. A connection is unregistered once its
+        // Disconnected event has been collected. Returns the number of events collected.
+        std::size_t drainInbound(std::vector<InboundEvent> &out, std::size_t per_conn = SIZE_MAX);
+        // As above, handing each event to cb(uint32_t id, MsgToMud &&ev). cb may call send().
+        template<typename F>
+        std::size_t drainInbound(F &&cb, std::size_t per_conn = SIZE_MAX) {
+            auto count = drainInbound(drained, per_conn);
+            for(auto &[id, ev] : drained) cb(id, std::move(ev));
+            drained.clear();
+            return count;
+        }
+        // Gives back the event ring storage of every connection with nothing queued. Game thread;
+        // worth calling now and then, e.g. once a minute, to keep idle connections small.
+        void trimIdle();
+        // Registers a connection. Returns false if max_connections are already registered.
+        bool add(std::shared_ptr<MudConnection> conn);
+        // Unregisters a connection and shuts it down once what was already queued for it is written.
+        void remove(uint32_t id);
+        // Called from an I/O thread when a connection that had no unread events gets one, e.g. to
+        // poke the game loop. Must not block.
+        std::function<void()> on_inbound;
+        // Longest command line a connection will buffer; anything longer is truncated.
+        std::size_t max_line_length = 4096;
+        // Largest WebSocket message a client may send, after decompression.
+        std::size_t max_message_size = 64 * 1024;
+        // Capacity of each connection's inbound and outbound event rings.
+        std::size_t event_capacity = 256;
+        // MCCP2/MCCP3 settings, and the memory limit shared by every connection's zlib streams.
+        CompressionConfig compression;
+        CompressionBudget compression_budget;
+        ConnTimers timers;
+        FlushPolicy flush;
+        Backpressure backpressure;
+        // Output bytes buffered across every connection. Safe to read from any thread.
+        std::atomic<std::size_t> buffered_bytes{0};
+        // Threads in the connection I/O pool, started by MudLink::startListening(). 0 means one
+        // per core. Listeners always run on io_con.
+        std::size_t io_threads = 0;
+        // Threads in a separate pool for TLS connections, so a storm of handshakes can't hold up
+        // everyone else. 0 (the default) keeps TLS connections on the main I/O pool.
+        std::size_t tls_threads = 0;
+        std::size_t max_connections;
+        // Where connection objects are allocated. Declared ahead of everything that may hold a
+        // connection, so it outlives them all.
+        SlabPool slab;
+        std::shared_mutex mut;
         boost::asio::io_context& io_con;
-        std::unordered_map<uint32_t, MudConnection*> connections, in_ready, out_ready;
+        IoPool pool, tls_pool;
+        // The timer wheel for ctx, out of whichever pool it belongs to.
+        TimerWheel& wheel(const boost::asio::execution_context &ctx);
+        std::unordered_map<uint32_t, std::shared_ptr<MudConnection>> connections;
+        // Ids of connections with unread inbound events. Filled by I/O threads, drained by the game.
+        MpscRing<uint32_t> in_ready;
+        // Ids of connections sent something since the last processOutEvents(). Game thread only.
+        std::vector<uint32_t> out_ready;
+    private:
+        // Runs fn on conn's strand, unless it has been closed by then.
+        static void postTo(const std::shared_ptr<MudConnection> &conn, void (MudConnection::*fn)());
+        // Pushes an event onto a connection's ring and records it for the next processOutEvents().
+        SendStatus queue(MudConnection *conn, MsgFromMud &&ev);
+        // Queues ev's payload, encoded for conn's render class, on conn. Encodings are cached in
+        // shared_cache for the rest of the broadcast.
+        SendStatus queueShared(MudConnection *conn, const MsgFromMud &ev);
+        static bool queued(SendStatus status) {
+            return status == SendStatus::Queued || status == SendStatus::Backlogged;
+        }
+        std::vector<std::pair<uint8_t, SharedBuffer>> shared_cache;
+        // Scratch space for drainInbound, kept to reuse its capacity. Game thread only.
+        std::vector<InboundEvent> drained;
+        std::vector<uint32_t> carried, gone;
     };
 
 }
@@ -10,6 +10,7 @@
 #include <unordered_set>
 #include <cstdint>
 #include <list>
+#include <atomic>
 #include <optional>
 #include <memory>
 #include <boost/asio.hpp>
@@ -21,7 +22,9 @@
 #include <boost/algorithm/string/trim.hpp>
 
 #include "mudlink/mudconn.hpp"
+#include "mudlink/tls.hpp"
 #include "mudlink/telnet.hpp"
+#include "mudlink/websocket.hpp"
 
 
 
@@ -31,39 +34,65 @@ namespace mudlink {
     class MudLink;
     class MudListener;
 
+    // One acceptor of a listener, with its own accept counters.
+    struct ListenerShard {
+        explicit ListenerShard(boost::asio::io_context &ctx);
+        // Counts an accept made at time now.
+        void count(std::chrono::steady_clock::time_point now);
+        // Accepts made during the last full second.
+        [[nodiscard]] uint64_t acceptsPerSecond() const;
+        boost::asio::io_context &context;
+        boost::asio::ip::tcp::acceptor acceptor;
+        std::atomic<uint64_t> accepted{0}, current_count{0}, last_count{0};
+        std::atomic<int64_t> current_second{0};
+    };
+
     class MudListener {
     public:
+        // With one shard the acceptor runs on ConnQueue::io_con and deals connections out across the
+        // I/O pool. With more (0 = one per pool thread), each shard is its own SO_REUSEPORT acceptor
+        // on one pool context, and the connections it accepts stay on that context.
         MudListener(MudLink& lnk, std::string& name, ProtocolType type, boost::asio::ip::address& addr, uint16_t port,
-                    boost::asio::ssl::context* ssl_context);
+                    boost::asio::ssl::context* ssl_context, std::size_t shards = 1,
+                    int backlog = boost::asio::socket_base::max_listen_connections);
 
-        void listen();
+        void listen(ListenerShard &shard);
+        // The pool this listener's connections run on: the TLS pool, if it is a TLS listener and
+        // there is one.
+        IoPool& connectionPool();
         void start();
         void stop();
         MudLink& link;
         ProtocolType ptype;
         ConnQueue &cqueue;
         boost::asio::ssl::context* ssl_con;
-        bool running;
+        std::atomic<bool> running;
         std::string name;
-        boost::asio::ip::address& address;
+        boost::asio::ip::address address;
         uint16_t port;
+        std::size_t shard_count;
+        int backlog;
+        std::vector<std::unique_ptr<ListenerShard>> shards;
     private:
-        boost::asio::ip::tcp::acceptor acceptor;
+        void openShard(boost::asio::io_context &ctx, bool reuse_port);
     };
 
     class MudLink {
     public:
         MudLink(ConnQueue &cq);
-        void registerSSL(std::string name);
+        // Loads a certificate chain and private key (PEM) into a TLS context that listeners can then
+        // use by name.
+        void registerSSL(std::string name, std::string cert_file, std::string key_file, TlsConfig config = {});
         void registerAddress(std::string name, std::string addr);
         void registerListener(std::string name, std::string address, uint16_t port, ProtocolType type,
-                              std::optional<std::string> ssl_name);
+                              std::optional<std::string> ssl_name, std::size_t shards = 1,
+                              int backlog = boost::asio::socket_base::max_listen_connections);
         void startListening();
         void stopListening();
         std::unordered_map<std::string, MudListener*> listeners;
-        uint32_t nextId = 0;
+        std::atomic<uint32_t> nextId = 0;
         std::unordered_map<std::string, boost::asio::ip::address> addresses;
-        std::unordered_map<std::string, boost::asio::ssl::context*> ssl_contexts;
+        std::unordered_map<std::string, std::unique_ptr<TlsContext>> ssl_contexts;
         ConnQueue &cqueue;
     };
 
@@ -0,0 +1,347 @@
+#ifndef MUDLINK_OOB_H
+#define MUDLINK_OOB_H
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "mudlink/mudconn.hpp"
+
+namespace mudlink {
+
+    // Out-of-band messages travel between mudlink and the game GMCP-style: a package name and a
+    // JSON payload. These convert to and from MSDP for clients that only speak that.
+    enum MsdpCode : uint8_t {
+        MSDP_VAR = 1,
+        MSDP_VAL = 2,
+        MSDP_TABLE_OPEN = 3,
+        MSDP_TABLE_CLOSE = 4,
+        MSDP_ARRAY_OPEN = 5,
+        MSDP_ARRAY_CLOSE = 6
+    };
+
+    // Appends text to out as the body of a JSON string, escaping as needed.
+    void appendJsonString(std::string &out, std::string_view text);
+
+    // Decodes the body of an IAC SB MSDP ... IAC SE (IACs already undoubled) into one OobMessage
+    // per variable, its value as JSON: tables become objects, arrays (or a variable given several
+    // values) arrays, and anything else a string. Stops at the first malformed variable.
+    void decodeMsdp(std::string_view data, std::vector<OobMessage> &out);
+
+    // Hands emit(std::string_view) the MSDP form of a JSON value, as it would follow MSDP_VAL:
+    // objects become tables, arrays arrays, and strings, numbers and booleans plain values. A
+    // payload that doesn't look like JSON is passed on as a plain value. Nothing is buffered.
+    template<typename F>
+    void encodeMsdpValue(std::string_view json, F &&emit);
+
+    // Variables the game keeps a client up to date on, named Package.key. The game can set them as
+    // often as it likes: flush() only sends the ones whose value has changed since the client last
+    // got them. GMCP clients get one Package {"key":value,...} message per package, and MSDP
+    // clients one VAR key VAL value each for the keys they have asked for with REPORT.
+    class OobVars {
+    public:
+        // json is the variable's value, as JSON.
+        void set(std::string_view name, std::string_view json);
+        // Handles the client's MSDP REPORT, UNREPORT and SEND. Names not yet set are ignored. False
+        // for any other variable.
+        bool command(const OobMessage &msg);
+        // Everything goes out again on the next flush, as though the client had never had it.
+        void resend();
+        // Hands out whatever needs sending to a client speaking mode, calling message(true) and
+        // message(false) around each GMCP message or MSDP subnegotiation body, and emit(run) for
+        // its contents. Variables set since the last flush are sent once, with their last value.
+        template<typename M, typename F>
+        void flush(OobMode mode, M &&message, F &&emit);
+    private:
+        struct StringHash {
+            using is_transparent = void;
+            std::size_t operator()(std::string_view s) const { return std::hash<std::string_view>()(s); }
+        };
+        struct Var {
+            std::string value, sent;
+            // force sends it even if unchanged or not reported; unsent means sent is meaningless.
+            bool dirty = false, force = false, unsent = true;
+        };
+        using Table = std::unordered_map<std::string, Var, StringHash, std::equal_to<>>;
+        // The part of a name after its last dot: the GMCP key, and the whole name for MSDP.
+        static std::string_view key(std::string_view name);
+        void mark(Table::value_type &var);
+        Table vars;
+        // Variables set since the last flush.
+        std::vector<Table::value_type*> dirty;
+        // Keys an MSDP client has asked to be sent, out of those the game had set when it asked.
+        std::unordered_set<std::string, StringHash, std::equal_to<>> reported;
+    };
+
+    namespace detail {
+
+        template<typename F>
+        class JsonToMsdp {
+        public:
+            JsonToMsdp(std::string_view json, F &emit) : json(json), emit(emit) {}
+
+            bool value(unsigned depth) {
+                space();
+                if(pos == json.size() || depth > max_depth) return false;
+                switch(json[pos]) {
+                    case '{': {
+                        pos++;
+                        code(MSDP_TABLE_OPEN);
+                        space();
+                        if(peek('}')) break;
+                        do {
+                            space();
+                            code(MSDP_VAR);
+                            if(!peek('"') || !string()) return false;
+                            space();
+                            if(!peek(':')) return false;
+                            code(MSDP_VAL);
+                            if(!value(depth + 1)) return false;
+                            space();
+                        } while(peek(','));
+                        if(!peek('}')) return false;
+                        break;
+                    }
+                    case '[':
+                        pos++;
+                        code(MSDP_ARRAY_OPEN);
+                        space();
+                        if(peek(']')) break;
+                        do {
+                            code(MSDP_VAL);
+                            if(!value(depth + 1)) return false;
+                            space();
+                        } while(peek(','));
+                        if(!peek(']')) return false;
+                        break;
+                    case '"':
+                        pos++;
+                        return string();
+                    default: {
+                        // A number, true or false. MSDP has no null, so that is an empty value.
+                        auto start = pos;
+                        while(pos < json.size() && json[pos] != ',' && json[pos] != ']' && json[pos] != '}' &&
+                              !isSpace(json[pos])) {
+                            pos++;
+                        }
+                        auto token = json.substr(start, pos - start);
+                        if(token.empty()) return false;
+                        if(token != "null") emit(token);
+                        return true;
+                    }
+                }
+                // Closing brackets are only consumed by the cases above once they have been emitted for.
+                code(json[pos - 1] == '}' ? MSDP_TABLE_CLOSE : MSDP_ARRAY_CLOSE);
+                return true;
+            }
+
+        private:
+            static constexpr unsigned max_depth = 32;
+            std::string_view json;
+            F &emit;
+            std::size_t pos = 0;
+
+            static bool isSpace(char c) {
+                return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+            }
+
+            void space() {
+                while(pos < json.size() && isSpace(json[pos])) pos++;
+            }
+
+            bool peek(char c) {
+                if(pos < json.size() && json[pos] == c) {
+                    pos++;
+                    return true;
+                }
+                return false;
+            }
+
+            void code(MsdpCode c) {
+                const char out = (char)c;
+                emit(std::string_view(&out, 1));
+            }
+
+            // The body of a string whose opening quote has been consumed, unescaped.
+            bool string() {
+                auto start = pos;
+                while(pos < json.size()) {
+                    auto c = json[pos];
+                    if(c == '"') {
+                        if(pos > start) emit(json.substr(start, pos - start));
+                        pos++;
+                        return true;
+                    }
+                    if(c != '\\') {
+                        pos++;
+                        continue;
+                    }
+                    if(pos > start) emit(json.substr(start, pos - start));
+                    if(++pos == json.size()) return false;
+                    if(!escape()) return false;
+                    start = pos;
+                }
+                return false;
+            }
+
+            bool escape() {
+                char out[4];
+                switch(json[pos++]) {
+                    case 'b': out[0] = '\b'; break;
+                    case 'f': out[0] = '\f'; break;
+                    case 'n': out[0] = '\n'; break;
+                    case 'r': out[0] = '\r'; break;
+                    case 't': out[0] = '\t'; break;
+                    case 'u': {
+                        uint32_t cp;
+                        if(!hex(cp)) return false;
+                        if(cp >= 0xD800 && cp < 0xDC00) {
+                            uint32_t low;
+                            if(json.substr(pos, 2) != "\\u") return false;
+                            pos += 2;
+                            if(!hex(low) || low < 0xDC00 || low >= 0xE000) return false;
+                            cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                        }
+                        // NUL and the MSDP codes can't appear in a value.
+                        if(cp <= MSDP_ARRAY_CLOSE) return true;
+                        emit(std::string_view(out, utf8(cp, out)));
+                        return true;
+                    }
+                    default:
+                        // \" \\ \/ and anything unknown stand for themselves.
+                        out[0] = json[pos - 1];
+                        break;
+                }
+                emit(std::string_view(out, 1));
+                return true;
+            }
+
+            bool hex(uint32_t &cp) {
+                if(pos + 4 > json.size()) return false;
+                cp = 0;
+                for(auto i = 0; i < 4; i++) {
+                    auto c = json[pos++];
+                    cp <<= 4;
+                    if(c >= '0' && c <= '9') cp |= c - '0';
+                    else if(c >= 'a' && c <= 'f') cp |= c - 'a' + 10;
+                    else if(c >= 'A' && c <= 'F') cp |= c - 'A' + 10;
+                    else return false;
+                }
+                return true;
+            }
+
+            static std::size_t utf8(uint32_t cp, char *out) {
+                if(cp < 0x80) {
+                    out[0] = (char)cp;
+                    return 1;
+                }
+                if(cp < 0x800) {
+                    out[0] = (char)(0xC0 | (cp >> 6));
+                    out[1] = (char)(0x80 | (cp & 0x3F));
+                    return 2;
+                }
+                if(cp < 0x10000) {
+                    out[0] = (char)(0xE0 | (cp >> 12));
+                    out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+                    out[2] = (char)(0x80 | (cp & 0x3F));
+                    return 3;
+                }
+                out[0] = (char)(0xF0 | (cp >> 18));
+                out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+                out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+                out[3] = (char)(0x80 | (cp & 0x3F));
+                return 4;
+            }
+        };
+
+    }
+
+    template<typename F>
+    void encodeMsdpValue(std::string_view json, F &&emit) {
+        auto start = json.find_first_not_of(" \t\r\n");
+        if(start == std::string_view::npos) return;
+        auto c = json[start];
+        if(c == '{' || c == '[' || c == '"' || c == '-' || (c >= '0' && c <= '9') || c == 't' || c == 'f' ||
+           c == 'n') {
+            // Malformed JSON is cut off where the error is; the caller still closes the subnegotiation.
+            detail::JsonToMsdp<F>(json, emit).value(0);
+            return;
+        }
+        emit(json);
+    }
+
+    template<typename M, typename F>
+    void OobVars::flush(OobMode mode, M &&message, F &&emit) {
+        if(mode == NoOob || dirty.empty()) return;
+        // Sorted by package then key, a package's variables are next to each other and go out as one
+        // message, even with a subpackage like Char.info between Char.hp and Char.mp.
+        std::sort(dirty.begin(), dirty.end(), [](auto *a, auto *b) {
+            auto ka = key(a->first), kb = key(b->first);
+            auto pa = std::string_view(a->first).substr(0, a->first.size() - ka.size());
+            auto pb = std::string_view(b->first).substr(0, b->first.size() - kb.size());
+            return pa != pb ? pa < pb : ka < kb;
+        });
+        constexpr char var_code[] = {(char)MSDP_VAR}, val_code[] = {(char)MSDP_VAL};
+        std::string_view open;
+        bool writing = false;
+        for(auto *entry : dirty) {
+            auto &[name, var] = *entry;
+            bool wanted = mode == OobGMCP || var.force || reported.find(key(name)) != reported.end();
+            bool changed = var.force || var.unsent || var.value != var.sent;
+            var.dirty = var.force = false;
+            if(!wanted || !changed) continue;
+            var.sent = var.value;
+            var.unsent = false;
+            auto k = key(name);
+            if(mode == OobMSDP) {
+                // Every variable goes in the one subnegotiation.
+                if(!writing) message(true);
+                writing = true;
+                emit(std::string_view(var_code, 1));
+                emit(k);
+                emit(std::string_view(val_code, 1));
+                encodeMsdpValue(var.value, emit);
+                continue;
+            }
+            auto package = std::string_view(name).substr(0, name.size() - k.size() - (k.size() < name.size()));
+            if(writing && !package.empty() && package == open) {
+                emit(std::string_view(","));
+            } else {
+                if(writing) {
+                    emit(std::string_view("}"));
+                    message(false);
+                }
+                message(true);
+                if(package.empty()) {
+                    // No package, so the value is the whole payload.
+                    emit(k);
+                    emit(std::string_view(" "));
+                    emit(std::string_view(var.value));
+                    message(false);
+                    writing = false;
+                    continue;
+                }
+                emit(package);
+                emit(std::string_view(" {"));
+                open = package;
+                writing = true;
+            }
+            emit(std::string_view("\""));
+            emit(k);
+            emit(std::string_view("\":"));
+            emit(var.value.empty() ? std::string_view("null") : std::string_view(var.value));
+        }
+        if(writing) {
+            if(mode == OobGMCP) emit(std::string_view("}"));
+            message(false);
+        }
+        dirty.clear();
+    }
+
+}
+
+#endif //MUDLINK_OOB_H
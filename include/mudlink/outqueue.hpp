@@ -0,0 +1,61 @@
+#ifndef MUDLINK_OUTQUEUE_H
+#define MUDLINK_OUTQUEUE_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <boost/asio/buffer.hpp>
+#include "mudlink/pool.hpp"
+
+namespace mudlink {
+
+    // Immutable bytes that are ready for the wire and can be queued on any number of connections.
+    using SharedBuffer = std::shared_ptr<const std::string>;
+
+    // Output waiting to be written to a connection. It is a queue of segments, each either bytes
+    // copied in by this connection or a SharedBuffer it holds a reference to, and is flushed
+    // with one vectored write. All of its memory comes from BufferPool and is given back once
+    // the queue drains, so an idle connection's queues hold nothing.
+    class OutputQueue {
+    public:
+        // Copies bytes onto the end, into the last segment when that is safe.
+        void append(std::string_view bytes);
+        // Queues buf itself without copying.
+        void append(SharedBuffer buf);
+        // Reserves len writable bytes on the end for a producer that writes in place, such as a
+        // compressor. commit() then keeps the first len of them.
+        char* prepare(std::size_t len);
+        void commit(std::size_t len);
+        // Moves every segment onto the end of other without copying any bytes. This queue may not
+        // have a write in flight.
+        void moveTo(OutputQueue &other);
+        [[nodiscard]] std::size_t size() const;
+        [[nodiscard]] bool empty() const;
+        // Adds buffers for up to max_segments segments to out and marks them as in flight, so
+        // later appends leave their memory alone until consume() is called.
+        std::size_t gather(std::vector<boost::asio::const_buffer> &out, std::size_t max_segments = 64);
+        // Drops len written bytes from the front and clears the in-flight mark.
+        void consume(std::size_t len);
+        // Drops everything.
+        void clear();
+    private:
+        struct Segment {
+            SharedBuffer shared;
+            // Always reserved from the pool, never short-string storage, so its bytes stay put
+            // when segments is reallocated under a write in flight.
+            PooledString local;
+            std::size_t offset = 0;
+            [[nodiscard]] std::string_view view() const;
+        };
+        // Adds an empty local segment with room for at least len bytes.
+        PooledString& addLocal(std::size_t len);
+        // Live segments are [head, segments.size()).
+        std::vector<Segment, BufferAllocator<Segment>> segments;
+        std::size_t head = 0, bytes = 0, in_flight = 0, reserved = 0;
+    };
+
+}
+
+#endif //MUDLINK_OUTQUEUE_H
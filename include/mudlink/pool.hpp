@@ -0,0 +1,97 @@
+#ifndef MUDLINK_POOL_H
+#define MUDLINK_POOL_H
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace mudlink {
+
+    // Per-thread caches of power-of-two sized blocks, from min_block to max_block, for buffer
+    // memory that comes and goes with traffic. A block freed on an I/O thread is handed to the
+    // next connection on that thread that needs one, so memory is reused rather than returned to
+    // the allocator and RSS stays flat. Larger requests go straight to operator new.
+    class BufferPool {
+    public:
+        static constexpr std::size_t min_block = 256, max_block = 64 * 1024;
+        // Most bytes of any one size a thread keeps cached. Anything freed past that is released.
+        static constexpr std::size_t max_cached = 4 * 1024 * 1024;
+        // Returns at least bytes bytes, and rounds bytes up to what was actually handed out.
+        static void* acquire(std::size_t &bytes);
+        // bytes may be the size asked of acquire() or the size it settled on.
+        static void release(void *ptr, std::size_t bytes);
+    };
+
+    // A std allocator over BufferPool.
+    template<typename T>
+    struct BufferAllocator {
+        using value_type = T;
+        BufferAllocator() = default;
+        template<typename U>
+        BufferAllocator(const BufferAllocator<U> &) {}
+        T* allocate(std::size_t n) {
+            auto bytes = n * sizeof(T);
+            return static_cast<T*>(BufferPool::acquire(bytes));
+        }
+        void deallocate(T *ptr, std::size_t n) {
+            BufferPool::release(ptr, n * sizeof(T));
+        }
+        template<typename U>
+        bool operator==(const BufferAllocator<U> &) const { return true; }
+    };
+
+    using PooledString = std::basic_string<char, std::char_traits<char>, BufferAllocator<char>>;
+
+    // A thread-safe pool of fixed-size objects, carved out of slabs that hold objects_per_slab of
+    // them at a time, for long-lived objects like connections. Each distinct object size gets its
+    // own free list. Slabs are only released when the pool is destroyed, by which time every
+    // object must have been freed.
+    class SlabPool {
+    public:
+        explicit SlabPool(std::size_t objects_per_slab = 64);
+        ~SlabPool();
+        SlabPool(const SlabPool &) = delete;
+        SlabPool& operator=(const SlabPool &) = delete;
+        void* allocate(std::size_t bytes, std::size_t align = alignof(std::max_align_t));
+        void deallocate(void *ptr, std::size_t bytes, std::size_t align = alignof(std::max_align_t));
+        // Bytes held in slabs, in use or not.
+        [[nodiscard]] std::size_t reserved() const;
+    private:
+        struct FreeNode {
+            FreeNode *next;
+        };
+        struct SizeClass {
+            std::size_t size, align;
+            FreeNode *free = nullptr;
+        };
+        SizeClass& classFor(std::size_t bytes, std::size_t align);
+        std::size_t objects_per_slab;
+        mutable std::mutex mut;
+        std::vector<SizeClass> classes;
+        std::vector<std::pair<void*, std::size_t>> slabs;
+        std::size_t slab_bytes = 0;
+    };
+
+    // A std allocator over a SlabPool, for std::allocate_shared.
+    template<typename T>
+    struct SlabAllocator {
+        using value_type = T;
+        explicit SlabAllocator(SlabPool &pool) : pool(&pool) {}
+        template<typename U>
+        SlabAllocator(const SlabAllocator<U> &other) : pool(other.pool) {}
+        T* allocate(std::size_t n) {
+            return static_cast<T*>(pool->allocate(n * sizeof(T), alignof(T)));
+        }
+        void deallocate(T *ptr, std::size_t n) {
+            pool->deallocate(ptr, n * sizeof(T), alignof(T));
+        }
+        template<typename U>
+        bool operator==(const SlabAllocator<U> &other) const { return pool == other.pool; }
+        SlabPool *pool;
+    };
+
+}
+
+#endif //MUDLINK_POOL_H
@@ -0,0 +1,190 @@
+#ifndef MUDLINK_RING_H
+#define MUDLINK_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include "mudlink/pool.hpp"
+
+namespace mudlink {
+
+    // Keeps producer and consumer indexes on separate cache lines.
+    constexpr std::size_t cache_line = 64;
+
+    constexpr std::size_t roundUpPow2(std::size_t n) {
+        std::size_t out = 1;
+        while(out < n) out <<= 1;
+        return out;
+    }
+
+    // Bounded lock-free queue for exactly one producer thread and one consumer thread.
+    // Slot storage comes from BufferPool on the producer's first push, so a connection that never
+    // queues anything never pays for it, and trim() hands it back once the ring is empty again.
+    template<typename T>
+    class SpscRing {
+        static_assert(alignof(T) <= alignof(std::max_align_t));
+    public:
+        explicit SpscRing(std::size_t capacity) : mask(roundUpPow2(capacity) - 1) {}
+        SpscRing(const SpscRing &) = delete;
+        SpscRing& operator=(const SpscRing &) = delete;
+
+        ~SpscRing() {
+            if(!slots) return;
+            auto h = head.load(std::memory_order_relaxed), t = tail.load(std::memory_order_relaxed);
+            for(; h != t; h++) slot(h)->~T();
+            BufferPool::release(slots, sizeof(T) * (mask + 1));
+        }
+
+        // Producer side. Returns false if the ring is full, leaving v untouched.
+        bool push(T &&v) {
+            auto t = tail.load(std::memory_order_relaxed);
+            if(t - head_cache > mask) {
+                head_cache = head.load(std::memory_order_acquire);
+                if(t - head_cache > mask) return false;
+            }
+            if(!slots) allocate();
+            new (slot(t)) T(std::move(v));
+            tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Producer side. Moves items from [first, last) until the ring fills, publishing them all
+        // at once. Returns the number moved.
+        template<typename It>
+        std::size_t pushBatch(It first, It last) {
+            auto t = tail.load(std::memory_order_relaxed);
+            head_cache = head.load(std::memory_order_acquire);
+            auto room = (mask + 1) - (t - head_cache);
+            std::size_t count = 0;
+            if(!slots && first != last) allocate();
+            for(; first != last && count < room; ++first, ++count) {
+                new (slot(t + count)) T(std::move(*first));
+            }
+            if(count) tail.store(t + count, std::memory_order_release);
+            return count;
+        }
+
+        // Consumer side. Hands up to max items to cb(T&&), oldest first, and frees their slots
+        // in one step. Returns the number handed over.
+        template<typename F>
+        std::size_t popBatch(F &&cb, std::size_t max = SIZE_MAX) {
+            auto h = head.load(std::memory_order_relaxed);
+            if(h == tail_cache) {
+                tail_cache = tail.load(std::memory_order_acquire);
+                if(h == tail_cache) return 0;
+            }
+            std::size_t count = 0;
+            for(; h + count != tail_cache && count < max; count++) {
+                auto item = slot(h + count);
+                cb(std::move(*item));
+                item->~T();
+            }
+            head.store(h + count, std::memory_order_release);
+            return count;
+        }
+
+        // Producer side. Gives the slot storage back to the pool if the consumer has taken
+        // everything. The consumer only reads slots after seeing tail move, which the next push
+        // does after allocating again, so this is safe while it runs.
+        void trim() {
+            if(!slots || head.load(std::memory_order_acquire) != tail.load(std::memory_order_relaxed)) return;
+            BufferPool::release(slots, sizeof(T) * (mask + 1));
+            slots = nullptr;
+        }
+
+        // Safe from either side, but only exact from the consumer.
+        [[nodiscard]] bool empty() const {
+            return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+        }
+
+        [[nodiscard]] std::size_t capacity() const {
+            return mask + 1;
+        }
+
+    private:
+        T* slot(std::size_t i) const {
+            return slots + (i & mask);
+        }
+
+        void allocate() {
+            auto bytes = sizeof(T) * (mask + 1);
+            slots = static_cast<T*>(BufferPool::acquire(bytes));
+        }
+
+        const std::size_t mask;
+        T* slots = nullptr;
+        alignas(cache_line) std::atomic<std::size_t> head{0};
+        std::size_t tail_cache = 0;
+        alignas(cache_line) std::atomic<std::size_t> tail{0};
+        std::size_t head_cache = 0;
+    };
+
+    // Bounded lock-free queue for any number of producer threads and one consumer thread.
+    // Each slot carries a sequence number that tells producers and the consumer whose turn it is.
+    template<typename T>
+    class MpscRing {
+    public:
+        explicit MpscRing(std::size_t capacity) : mask(roundUpPow2(capacity) - 1),
+            cells(std::make_unique<Cell[]>(mask + 1)) {
+            for(std::size_t i = 0; i <= mask; i++) cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+        MpscRing(const MpscRing &) = delete;
+        MpscRing& operator=(const MpscRing &) = delete;
+
+        // Producer side; safe from any thread. Returns false if the ring is full.
+        bool push(T v) {
+            auto pos = tail.load(std::memory_order_relaxed);
+            while(true) {
+                auto &cell = cells[pos & mask];
+                auto seq = cell.seq.load(std::memory_order_acquire);
+                auto diff = (intptr_t)seq - (intptr_t)pos;
+                if(diff == 0) {
+                    if(tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        cell.value = std::move(v);
+                        cell.seq.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if(diff < 0) {
+                    return false;
+                } else {
+                    pos = tail.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // Consumer side. Hands up to max items to cb(T&&) in the order they were published.
+        // Stops early at a slot whose producer has claimed it but not finished writing.
+        template<typename F>
+        std::size_t popBatch(F &&cb, std::size_t max = SIZE_MAX) {
+            std::size_t count = 0;
+            for(; count < max; count++) {
+                auto &cell = cells[head & mask];
+                if(cell.seq.load(std::memory_order_acquire) != head + 1) break;
+                cb(std::move(cell.value));
+                cell.seq.store(head + mask + 1, std::memory_order_release);
+                head++;
+            }
+            return count;
+        }
+
+        [[nodiscard]] std::size_t capacity() const {
+            return mask + 1;
+        }
+
+    private:
+        struct Cell {
+            std::atomic<std::size_t> seq;
+            T value{};
+        };
+        const std::size_t mask;
+        std::unique_ptr<Cell[]> cells;
+        alignas(cache_line) std::size_t head = 0;
+        alignas(cache_line) std::atomic<std::size_t> tail{0};
+    };
+
+}
+
+#endif //MUDLINK_RING_H
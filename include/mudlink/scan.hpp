@@ -0,0 +1,23 @@
+#ifndef MUDLINK_SCAN_H
+#define MUDLINK_SCAN_H
+
+#include <cstddef>
+#include <string_view>
+
+namespace mudlink::scan {
+
+    // Returns the offset of the first IAC, CR, LF or NUL byte in data, or data.size() if there
+    // is none. These are the only bytes that matter to both the telnet message splitter and the
+    // line splitter, so one pass with this finds every boundary either of them needs.
+    // The kernel (AVX2, SSE2 or scalar) is picked once at runtime from what the CPU supports.
+    std::size_t findSpecial(std::string_view data);
+
+    // The portable kernel, exposed so it can be benchmarked against the vectorized ones.
+    std::size_t findSpecialScalar(std::string_view data);
+
+    // Name of the kernel findSpecial() dispatches to.
+    const char* kernelName();
+
+}
+
+#endif //MUDLINK_SCAN_H
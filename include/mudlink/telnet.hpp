@@ -5,16 +5,20 @@
 #ifndef MUDLINK_TELNET_H
 #define MUDLINK_TELNET_H
 
+#include <array>
 #include <vector>
 #include <memory>
 #include <cstdint>
 #include <optional>
-#include <unordered_map>
-#include <unordered_set>
+#include <type_traits>
+#include <string_view>
 #include <boost/asio/streambuf.hpp>
 #include <boost/asio/buffers_iterator.hpp>
-#include <boost/algorithm/string/trim.hpp>
 #include "mudlink/mudconn.hpp"
+#include "mudlink/lines.hpp"
+#include "mudlink/color.hpp"
+#include "mudlink/oob.hpp"
+#include "mudlink/scan.hpp"
 
 namespace mudlink::telnet {
 
@@ -48,7 +52,6 @@ namespace mudlink::telnet {
         MSSP = 70,
 
         // MCCP#: Mud Client Compression Protocol
-        // Not gonna support these.
         MCCP2 = 86,
         MCCP3 = 87,
 
@@ -70,59 +73,272 @@ namespace mudlink::telnet {
         Command = 3
     };
 
+    // A single parsed telnet message. data is a view into the buffer that was parsed, so it is
+    // only valid until that buffer is consumed; copy it if it needs to outlive the parse.
     struct TelnetMessage {
-        MessageType mtype;
-        uint8_t option, extra;
-        std::string data;
+        MessageType mtype = MessageType::Data;
+        uint8_t option = 0, extra = 0;
+        std::string_view data;
+        TelnetMessage() = default;
         explicit TelnetMessage(MessageType mt);
-        static std::optional<TelnetMessage> parse_bytes(boost::asio::streambuf &buf);
+        // Parses one message from the front of buf. Returns the number of bytes it used, or 0 if
+        // buf does not yet hold a complete message.
+        static std::size_t parse_one(std::string_view buf, TelnetMessage &out);
+        // Parses every complete message in buf, handing each to cb in order. Returns the number of
+        // bytes used, which the caller consumes in one go once it is done with the views. If cb
+        // returns bool, returning false stops parsing right after that message.
+        template<typename F>
+        static std::size_t parse_bytes(std::string_view buf, F &&cb) {
+            std::size_t used = 0;
+            while(used < buf.size()) {
+                TelnetMessage msg;
+                auto len = parse_one(buf.substr(used), msg);
+                if(!len) break;
+                used += len;
+                if constexpr(std::is_same_v<std::invoke_result_t<F, TelnetMessage&>, bool>) {
+                    if(!cb(msg)) break;
+                } else {
+                    cb(msg);
+                }
+            }
+            return used;
+        }
+        static std::size_t parse_bytes(std::string_view buf, std::vector<TelnetMessage> &out);
     };
 
     struct TelnetOptionPerspective {
-        bool enabled = false, negotiating = false, answered = false;
+        bool enabled : 1 = false, negotiating : 1 = false, answered : 1 = false;
     };
 
     struct TelnetOpState {
         TelnetOptionPerspective local, remote;
     };
 
+    // Options still waiting on an answer, one bit per option slot (see TelnetOptionInfo).
     struct TelnetHandshakeHolder {
-        std::unordered_set<TelnetCode> local, remote, special;
+        uint32_t local = 0, remote = 0, special = 0;
         bool empty() const;
     };
 
+    enum TelnetSupport : uint8_t {
+        SupportAny = 1,
+        SupportLocal = 2,
+        SupportRemote = 4
+    };
+
+    // What we do with one option code. Supported options get a slot, their index in the list of
+    // supported options, which is where their state and handshake bit live.
+    struct TelnetOptionInfo {
+        uint8_t support = 0, slot = 0;
+    };
+
+    template<std::size_t A, std::size_t L, std::size_t R>
+    constexpr std::array<TelnetOptionInfo, 256> makeOptionTable(const TelnetCode (&any)[A], const TelnetCode (&local)[L],
+                                                                const TelnetCode (&remote)[R]) {
+        std::array<TelnetOptionInfo, 256> out{};
+        for(auto &o : out) o.slot = A;
+        for(std::size_t i = 0; i < A; i++) {
+            out[any[i]].support |= SupportAny;
+            out[any[i]].slot = i;
+        }
+        for(auto c : local) out[c].support |= SupportLocal;
+        for(auto c : remote) out[c].support |= SupportRemote;
+        return out;
+    }
+
     struct TelnetConnection : public MudConnection {
-        explicit TelnetConnection(ConnQueue &cq, uint32_t id);
+        TelnetConnection(ConnQueue &cq, uint32_t id, TcpSocket sock);
         constexpr static TelnetCode supported[] = {SGA, NAWS, MTTS, MXP, MSSP, MCCP2, MCCP3, GMCP, MSDP, LINEMODE, TELOPT_EOR};
-        constexpr static TelnetCode start_local[] = {SGA, MSSP, GMCP, MSDP, TELOPT_EOR};
-        constexpr static TelnetCode support_local[] = {SGA, MSSP, GMCP, MSDP, TELOPT_EOR};
+        constexpr static TelnetCode start_local[] = {SGA, MSSP, GMCP, MSDP, TELOPT_EOR, MCCP2, MCCP3};
+        constexpr static TelnetCode support_local[] = {SGA, MSSP, GMCP, MSDP, TELOPT_EOR, MCCP2, MCCP3};
         constexpr static TelnetCode start_remote[] = {NAWS, MTTS, LINEMODE};
         constexpr static TelnetCode support_remote[] = {SGA, NAWS, MTTS, MSSP, GMCP, MSDP, LINEMODE, TELOPT_EOR};
-        std::unordered_map<uint8_t, TelnetOpState> states;
-        std::string cmdbuff;
-        std::optional<std::string> mtts_last;
+        constexpr static auto options = makeOptionTable(supported, support_local, support_remote);
+        static_assert(std::size(supported) <= 32, "handshake masks hold one bit per supported option");
+        // Indexed by slot. The spare entry at the end is where every unsupported option lands.
+        std::array<TelnetOpState, std::size(supported) + 1> states{};
+        LineAssembler cmdbuff;
+        // The TTYPE cycle: answers so far, and the last one, as a client that has no more to say
+        // repeats itself. The MTTS handshake bit in handshakes.special is set while it runs.
+        uint8_t mtts_round = 0;
+        std::string mtts_last;
         TelnetHandshakeHolder handshakes;
         bool sga = true, compress, changed = false;
-        boost::asio::high_resolution_timer timer;
-        static bool supportRemote(uint8_t code), supportLocal(uint8_t code), supportAny(uint8_t code);
-        void sendBytes(std::string &data);
+        // Set up once the client agrees to MCCP3, and put to work when it sends IAC SB MCCP3
+        // IAC SE, at which point inflate_next tells onReceive to stop parsing.
+        std::unique_ptr<Decompressor> mccp3;
+        bool inflate_next = false;
+        // Makes the connection ready if the client hasn't answered every offer by then.
+        WheelTimer ready_timer;
+        OobVars oob_vars;
+        constexpr static bool supportAny(uint8_t code) { return options[code].support & SupportAny; }
+        constexpr static bool supportLocal(uint8_t code) { return options[code].support & SupportLocal; }
+        constexpr static bool supportRemote(uint8_t code) { return options[code].support & SupportRemote; }
+        constexpr static uint32_t handshakeBit(uint8_t code) { return 1u << options[code].slot; }
+        TelnetOpState& opState(uint8_t code) { return states[options[code].slot]; }
+        // Queue data for the send() each handler makes once it's done, so that everything one
+        // batch or one read produces goes out in a single write.
+        void sendBytes(std::string_view data);
+        void sendBytes(SharedBuffer data);
+        // Queues text encoded for this connection's render class.
+        void sendText(std::string_view text);
+        // Hands emit(std::string_view) the wire form of text for clients of class rc: colours
+        // rendered down to its colour depth (see renderText), non-ASCII replaced if it has no UTF-8,
+        // IACs doubled and bare LFs turned into CRLF.
+        template<typename F>
+        static void encodeText(std::string_view text, RenderClass rc, F &&emit);
+        // As encodeText, for a whole Line/Text/Prompt event including its line or prompt ending, or
+        // an OobData event as a GMCP or MSDP subnegotiation.
+        template<typename F>
+        static void encodeEvent(const MsgFromMud &ev, RenderClass rc, F &&emit);
+        // Hands emit data with its IACs doubled.
+        template<typename F>
+        static void escapeIac(std::string_view data, F &&emit);
+        // IAC SB GMCP package payload IAC SE, or for MSDP clients IAC SB MSDP VAR package VAL value
+        // IAC SE with the JSON payload transcoded as it goes. Nothing if rc has no OOB.
+        template<typename F>
+        static void encodeOob(const OobMessage &oob, RenderClass rc, F &&emit);
+        [[nodiscard]] SharedBuffer encodeShared(const MsgFromMud &ev, RenderClass rc) const override;
+        void updateRenderClass() override;
+        // Encodes MSSP variables as one IAC SB MSSP ... IAC SE sequence, ready to share between connections.
+        static SharedBuffer encodeMSSP(const MsspData &data);
         void start() override;
         void onReceive() override;
-        void processFromMud(MsgFromMud &ev) override;
+        void processFromMud(MsgFromMud &&ev) override;
+        // Changed variables as GMCP messages or one MSDP subnegotiation, whichever the client speaks.
+        void flushOob() override;
         void finishReady();
-        void receiveData(std::string &data);
+        void receiveData(std::string_view data);
         void receiveCommand(uint8_t cmd);
-        void sendSubNegotiate(TelnetCode op, std::string &data);
+        void sendSubNegotiate(TelnetCode op, std::string_view data);
         void receiveNegotiate(TelnetCode neg, uint8_t op);
         void sendNegotiation(TelnetCode neg, uint8_t op);
-        void receiveSubnegotiation(uint8_t op, std::string &data);
+        void sendCommand(TelnetCode cmd);
+        // An IAC NOP.
+        void keepAlive() override;
+        void receiveSubnegotiation(uint8_t op, std::string_view data);
+        // IAC SB TTYPE SEND IAC SE.
+        void requestTerminalType();
+        // One round of MTTS: the client name, then the terminal type, then MTTS and its bits.
+        void receiveTerminalType(std::string_view data);
+        void endTerminalType();
+        // NAWS width and height, two bytes each.
+        void receiveWindowSize(std::string_view data);
         void processMessage(TelnetMessage &msg);
         void enableLocal(TelnetCode op);
         void enableRemote(TelnetCode op);
         void disableLocal(TelnetCode op);
         void disableRemote(TelnetCode op);
+        // Brings cap.gmcp/msdp/oob and the render class in line with the GMCP and MSDP options.
+        void updateOob();
     };
 
+    template<typename F>
+    void TelnetConnection::encodeText(std::string_view text, RenderClass rc, F &&emit) {
+        RenderScratch scratch;
+        text = renderText(text, rc.color, rc.utf8, scratch);
+        constexpr char iac_iac[] = {(char)IAC, (char)IAC};
+        bool after_cr = false;
+        while(!text.empty()) {
+            auto pos = scan::findSpecial(text);
+            if(pos == text.size()) {
+                emit(text);
+                break;
+            }
+            auto c = (uint8_t)text[pos];
+            switch(c) {
+                case IAC:
+                    emit(text.substr(0, pos));
+                    emit(std::string_view(iac_iac, 2));
+                    break;
+                case LF:
+                    if(pos == 0 && after_cr) {
+                        emit(text.substr(0, 1));
+                    } else {
+                        emit(text.substr(0, pos));
+                        emit(std::string_view("\r\n"));
+                    }
+                    break;
+                default:
+                    emit(text.substr(0, pos + 1));
+                    break;
+            }
+            after_cr = c == CR;
+            text.remove_prefix(pos + 1);
+        }
+    }
+
+    template<typename F>
+    void TelnetConnection::encodeEvent(const MsgFromMud &ev, RenderClass rc, F &&emit) {
+        auto text = std::get_if<std::string>(&ev.data);
+        switch(ev.mtype) {
+            case FromMudEvent::Line:
+                if(text) encodeText(*text, rc, emit);
+                emit(std::string_view("\r\n"));
+                break;
+            case FromMudEvent::Text:
+                if(text) encodeText(*text, rc, emit);
+                break;
+            case FromMudEvent::Prompt: {
+                if(text) encodeText(*text, rc, emit);
+                constexpr char ga[] = {(char)IAC, (char)GA}, eor[] = {(char)IAC, (char)EOR};
+                if(rc.prompt == PromptEOR) emit(std::string_view(eor, 2));
+                else if(rc.prompt == PromptGA) emit(std::string_view(ga, 2));
+                break;
+            }
+            case FromMudEvent::OobData:
+                if(auto oob = std::get_if<OobMessage>(&ev.data)) encodeOob(*oob, rc, emit);
+                break;
+            default:
+                break;
+        }
+    }
+
+    template<typename F>
+    void TelnetConnection::escapeIac(std::string_view data, F &&emit) {
+        constexpr char iac_iac[] = {(char)IAC, (char)IAC};
+        while(!data.empty()) {
+            auto pos = data.find((char)IAC);
+            if(pos == std::string_view::npos) {
+                emit(data);
+                break;
+            }
+            emit(data.substr(0, pos));
+            emit(std::string_view(iac_iac, 2));
+            data.remove_prefix(pos + 1);
+        }
+    }
+
+    template<typename F>
+    void TelnetConnection::encodeOob(const OobMessage &oob, RenderClass rc, F &&emit) {
+        if(oob.package().empty()) return;
+        auto escaped = [&](std::string_view run) { escapeIac(run, emit); };
+        constexpr char se[] = {(char)IAC, (char)SE};
+        switch(rc.oob) {
+            case OobGMCP: {
+                constexpr char sb[] = {(char)IAC, (char)SB, (char)GMCP};
+                emit(std::string_view(sb, 3));
+                escaped(oob.package());
+                if(!oob.payload().empty()) {
+                    emit(std::string_view(" "));
+                    escaped(oob.payload());
+                }
+                break;
+            }
+            case OobMSDP: {
+                constexpr char sb[] = {(char)IAC, (char)SB, (char)MSDP, (char)MSDP_VAR}, val[] = {(char)MSDP_VAL};
+                emit(std::string_view(sb, 4));
+                escaped(oob.package());
+                emit(std::string_view(val, 1));
+                encodeMsdpValue(oob.payload(), escaped);
+                break;
+            }
+            default:
+                return;
+        }
+        emit(std::string_view(se, 2));
+    }
+
 }
 
 #endif //MUDLINK_TELNET_H
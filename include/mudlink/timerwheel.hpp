@@ -0,0 +1,99 @@
+#ifndef MUDLINK_TIMERWHEEL_H
+#define MUDLINK_TIMERWHEEL_H
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+namespace mudlink {
+
+    class TimerWheel;
+
+    namespace test {
+        class TimerWheelAccess;
+    }
+
+    // A timer on a TimerWheel, kept inside whatever owns it so arming it never allocates. When it
+    // expires fire(owner) is called on the wheel's thread with the wheel locked; it must not touch
+    // the wheel, and should only post whatever work is due to the owner's own executor.
+    class WheelTimer {
+    public:
+        using Fire = void (*)(void *owner);
+        WheelTimer(TimerWheel &wheel, Fire fire, void *owner);
+        ~WheelTimer();
+        WheelTimer(const WheelTimer &) = delete;
+        WheelTimer& operator=(const WheelTimer &) = delete;
+        // Arms the timer to fire after at least delay, replacing whatever it was armed for.
+        void schedule(std::chrono::milliseconds delay);
+        void cancel();
+    private:
+        friend class TimerWheel;
+        TimerWheel &wheel;
+        Fire fire;
+        void *owner;
+        // Guarded by the wheel's lock.
+        WheelTimer *prev = nullptr, *next = nullptr;
+        uint64_t due = 0;
+        uint16_t bucket = 0;
+        bool linked = false;
+    };
+
+    // Coarse timers for every connection on one io_context, driven by a single steady_timer that
+    // only runs while something is armed. Timers fire up to one tick late.
+    //
+    // The wheel is hierarchical: level 0 has a slot per tick for the next 64 ticks, and each level
+    // above covers 64 times the span of the one below. Arming and cancelling are O(1) at any
+    // range. Timers move down a level each time the level below wraps around, and the
+    // steady_timer only wakes for ticks that have something in them or a wrap to do.
+    class TimerWheel {
+    public:
+        explicit TimerWheel(boost::asio::io_context &ctx,
+                            std::chrono::milliseconds tick = std::chrono::milliseconds(50));
+        // Cancels the steady_timer. Must happen before ctx is destroyed; timers may still be
+        // cancelled afterwards, but nothing fires again.
+        void stop();
+        // Timers currently armed.
+        [[nodiscard]] std::size_t size() const;
+    private:
+        friend class WheelTimer;
+        friend class test::TimerWheelAccess;
+        static constexpr unsigned bits = 6, levels = 4;
+        static constexpr uint64_t slots = uint64_t(1) << bits;
+        void schedule(WheelTimer &t, std::chrono::milliseconds delay);
+        void cancel(WheelTimer &t);
+        // Puts t in the bucket for its due tick, relative to cursor.
+        void link(WheelTimer &t);
+        void unlink(WheelTimer &t);
+        // Re-files every timer in one bucket of an upper level, now that it is closer.
+        void cascade(unsigned level);
+        // Fires everything due up to the current tick and waits for the next one if anything is left.
+        void advance();
+        void wait();
+        // The next tick with anything to do: a level 0 slot with timers in it, or a wrap.
+        [[nodiscard]] uint64_t nextTick() const;
+        [[nodiscard]] uint64_t currentTick() const;
+        std::chrono::milliseconds tick;
+        std::chrono::steady_clock::time_point epoch;
+        std::optional<boost::asio::steady_timer> timer;
+        mutable std::mutex mut;
+        // Timers due in the same tick fire in the order they were armed.
+        struct Bucket {
+            WheelTimer *head = nullptr, *tail = nullptr;
+        };
+        std::array<Bucket, slots * levels> buckets{};
+        // Which buckets of each level have anything in them.
+        std::array<uint64_t, levels> occupied{};
+        // The next tick to process, and the one the steady_timer is waiting for.
+        uint64_t cursor = 0, wake = 0;
+        std::size_t count = 0;
+        bool waiting = false;
+    };
+
+}
+
+#endif //MUDLINK_TIMERWHEEL_H
@@ -0,0 +1,50 @@
+#ifndef MUDLINK_TLS_H
+#define MUDLINK_TLS_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <boost/asio/ssl.hpp>
+
+namespace mudlink {
+
+    struct TlsConfig {
+        // Sessions kept server-side for clients that resume by session id, and how long they last.
+        long session_cache_size = 20480;
+        std::chrono::seconds session_timeout{7200};
+        // Stateless session tickets. The key they are sealed with is replaced every ticket_rotation;
+        // tickets sealed with the one before are still accepted, and reissued, for one more period.
+        bool tickets = true;
+        std::chrono::seconds ticket_rotation{3600};
+    };
+
+    // A server ssl::context set up for resumption: a session cache for clients that resume by id,
+    // and session tickets under keys that are rotated as they age.
+    class TlsContext {
+    public:
+        // Throws if the certificate chain or private key (both PEM) can't be loaded.
+        TlsContext(const std::string &cert_file, const std::string &key_file, const TlsConfig &cfg);
+        TlsContext(const TlsContext &) = delete;
+        TlsContext& operator=(const TlsContext &) = delete;
+        boost::asio::ssl::context context;
+    private:
+        struct TicketKey {
+            std::array<unsigned char, 16> name{};
+            std::array<unsigned char, 32> aes{}, hmac{};
+            std::chrono::steady_clock::time_point created;
+        };
+        static TicketKey makeKey();
+        static int ticketCallback(SSL *ssl, unsigned char *key_name, unsigned char *iv, EVP_CIPHER_CTX *cctx,
+                                  EVP_MAC_CTX *hctx, int enc);
+        // Copies out the current and previous keys, rotating first if the current one is too old.
+        void keys(TicketKey &current, TicketKey &previous);
+        TlsConfig config;
+        std::mutex key_mut;
+        TicketKey current_key, previous_key;
+    };
+
+}
+
+#endif //MUDLINK_TLS_H
@@ -5,8 +5,97 @@
 #ifndef MUDLINK_WEBSOCKET_H
 #define MUDLINK_WEBSOCKET_H
 
+#include <string>
+#include <vector>
+#include <string_view>
+#include <boost/beast/core/flat_buffer.hpp>
+#include "mudlink/mudconn.hpp"
+#include "mudlink/lines.hpp"
+#include "mudlink/oob.hpp"
+
 namespace mudlink::websocket {
 
+    // One outgoing WebSocket message. Text output queued while a frame is being written is
+    // batched into the next one; OOB messages always get a frame of their own.
+    struct WebSocketFrame {
+        explicit WebSocketFrame(bool binary);
+        bool binary;
+        OutputQueue data;
+    };
+
+    // A MUD client speaking over WebSocket. Text frames carry lines of game text both ways, each
+    // line of an incoming one being a command. Binary frames carry OOB messages in GMCP form: a
+    // package name, a space, then a (usually JSON) payload.
+    struct WebSocketMudConnection : public MudConnection {
+        WebSocketMudConnection(ConnQueue &cq, uint32_t id, TcpSocket sock);
+        void onPlainConnect() override;
+        void onSecureConnect() override;
+        void start() override;
+        void send() override;
+        void receive() override;
+        void onReceive() override;
+        void processFromMud(MsgFromMud &&ev) override;
+        // Changed variables in GMCP form, a binary frame per package.
+        void flushOob() override;
+        [[nodiscard]] std::size_t bufferedBytes() const override;
+        // A ping frame.
+        void keepAlive() override;
+        [[nodiscard]] SharedBuffer encodeShared(const MsgFromMud &ev, RenderClass rc) const override;
+        // Whether ev goes out in a binary (OOB) frame rather than a text one.
+        static bool isBinary(FromMudEvent mt);
+        // Hands emit(std::string_view) the frame payload for ev.
+        template<typename F>
+        static void encodeEvent(const MsgFromMud &ev, F &&emit);
+        // The frame text should be appended to: the last one, unless it is the wrong kind or
+        // already being written.
+        OutputQueue& frameFor(bool binary);
+        // Starts the closing handshake, once shutdown() has let every frame go out.
+        void closeStream();
+        // Wraps the current transport, of type Next, in a WebSocket stream and accepts the handshake.
+        template<typename Next>
+        void accept();
+        LineAssembler cmdbuff;
+        // Incoming messages are read into this. Its memory comes from BufferPool and is given
+        // back after each message.
+        boost::beast::basic_flat_buffer<BufferAllocator<char>> inframe;
+        std::vector<WebSocketFrame, BufferAllocator<WebSocketFrame>> frames;
+        // Only one ping may be in flight at a time.
+        bool pinging = false;
+        OobVars oob_vars;
+    };
+
+    template<typename F>
+    void WebSocketMudConnection::encodeEvent(const MsgFromMud &ev, F &&emit) {
+        if(auto text = std::get_if<std::string>(&ev.data)) {
+            if(ev.mtype == FromMudEvent::Line || ev.mtype == FromMudEvent::Text || ev.mtype == FromMudEvent::Prompt) {
+                emit(std::string_view(*text));
+                if(ev.mtype == FromMudEvent::Line) emit(std::string_view("\n"));
+            }
+            return;
+        }
+        if(auto oob = std::get_if<OobMessage>(&ev.data)) {
+            emit(oob->package());
+            if(!oob->payload().empty()) {
+                emit(std::string_view(" "));
+                emit(oob->payload());
+            }
+            return;
+        }
+        if(auto mssp = std::get_if<MsspData>(&ev.data)) {
+            std::string out("MSSP {");
+            for(const auto &[k, v] : *mssp) {
+                if(out.back() != '{') out.push_back(',');
+                out.push_back('"');
+                appendJsonString(out, k);
+                out.append("\":\"");
+                appendJsonString(out, v);
+                out.push_back('"');
+            }
+            out.push_back('}');
+            emit(std::string_view(out));
+        }
+    }
+
 }
 
 #endif //MUDLINK_WEBSOCKET_H
@@ -0,0 +1,249 @@
+#include "mudlink/color.hpp"
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <memory>
+
+namespace mudlink {
+
+    namespace {
+
+        struct Rgb {
+            uint8_t r, g, b;
+        };
+
+        // xterm's defaults for the 16 colours, then the 6x6x6 cube and the grey ramp.
+        constexpr Rgb ansi_palette[16] = {
+                {0, 0, 0}, {205, 0, 0}, {0, 205, 0}, {205, 205, 0},
+                {0, 0, 238}, {205, 0, 205}, {0, 205, 205}, {229, 229, 229},
+                {127, 127, 127}, {255, 0, 0}, {0, 255, 0}, {255, 255, 0},
+                {92, 92, 255}, {255, 0, 255}, {0, 255, 255}, {255, 255, 255}};
+        constexpr uint8_t cube_levels[6] = {0, 95, 135, 175, 215, 255};
+
+        constexpr Rgb xtermRgb(unsigned i) {
+            if(i < 16) return ansi_palette[i];
+            if(i < 232) {
+                i -= 16;
+                return {cube_levels[i / 36], cube_levels[i / 6 % 6], cube_levels[i % 6]};
+            }
+            auto v = (uint8_t)(8 + 10 * (i - 232));
+            return {v, v, v};
+        }
+
+        constexpr unsigned distance(Rgb a, Rgb b) {
+            auto d = [](int x, int y) { return (unsigned)((x - y) * (x - y)); };
+            return d(a.r, b.r) + d(a.g, b.g) + d(a.b, b.b);
+        }
+
+        template<typename F>
+        constexpr std::array<uint8_t, 256> table(F f) {
+            std::array<uint8_t, 256> t{};
+            for(unsigned i = 0; i < 256; i++) t[i] = f(i);
+            return t;
+        }
+
+        // For each channel value, the nearest cube level and grey step.
+        constexpr auto cube_index = table([](unsigned v) {
+            uint8_t best = 0;
+            for(uint8_t k = 1; k < 6; k++) {
+                if(distance({cube_levels[k], 0, 0}, {(uint8_t)v, 0, 0}) <
+                   distance({cube_levels[best], 0, 0}, {(uint8_t)v, 0, 0})) best = k;
+            }
+            return best;
+        });
+        constexpr auto grey_index = table([](unsigned v) {
+            return (uint8_t)(v <= 8 ? 0 : std::min(23u, (v - 8 + 5) / 10));
+        });
+        constexpr auto ansi_of_xterm = table([](unsigned i) {
+            if(i < 16) return (uint8_t)i;
+            uint8_t best = 0;
+            for(uint8_t k = 1; k < 16; k++) {
+                if(distance(ansi_palette[k], xtermRgb(i)) < distance(ansi_palette[best], xtermRgb(i))) best = k;
+            }
+            return best;
+        });
+
+        void appendNumber(std::string &out, unsigned n) {
+            char digits[4];
+            auto len = 0;
+            do {
+                digits[len++] = (char)('0' + n % 10);
+                n /= 10;
+            } while(n && len < 4);
+            while(len) out.push_back(digits[--len]);
+        }
+
+        // Appends the SGR parameters for an xterm-256 colour, foreground or background, as a client
+        // of the given depth should get it.
+        void appendColor(std::string &out, bool background, unsigned index, MudColor color) {
+            if(color == MudColor::Ansi) {
+                auto a = ansi_of_xterm[index];
+                appendNumber(out, a < 8 ? (background ? 40 : 30) + a : (background ? 100 : 90) + a - 8);
+                return;
+            }
+            out.append(background ? "48;5;" : "38;5;");
+            appendNumber(out, index);
+        }
+
+        // Rewrites ESC [ params m, params being text's bytes from start to end, if it has extended
+        // colours the client can't show. False if it has none (or isn't plain SGR), for it to be
+        // copied as it is.
+        bool rewriteSgr(std::string_view params, MudColor color, std::string &out) {
+            constexpr std::size_t max_params = 32;
+            std::array<unsigned, max_params> p{};
+            std::size_t count = 1;
+            for(auto c : params) {
+                if(c == ';') {
+                    if(count == max_params) return false;
+                    count++;
+                } else if(c >= '0' && c <= '9') {
+                    p[count - 1] = std::min(9999u, p[count - 1] * 10 + (c - '0'));
+                } else {
+                    return false;
+                }
+            }
+            bool extended = false;
+            for(std::size_t i = 0; i + 1 < count; i++) {
+                if((p[i] == 38 || p[i] == 48) && (p[i + 1] == 5 || p[i + 1] == 2)) extended = true;
+            }
+            if(!extended) return false;
+
+            out.append("\x1b[");
+            for(std::size_t i = 0; i < count; i++) {
+                if(i) out.push_back(';');
+                bool background = p[i] == 48;
+                if((p[i] == 38 || background) && i + 2 < count && p[i + 1] == 5) {
+                    appendColor(out, background, std::min(255u, p[i + 2]), color);
+                    i += 2;
+                } else if((p[i] == 38 || background) && i + 4 < count && p[i + 1] == 2) {
+                    auto channel = [&](std::size_t k) { return (uint8_t)std::min(255u, p[k]); };
+                    appendColor(out, background, xtermFromRgb(channel(i + 2), channel(i + 3), channel(i + 4)), color);
+                    i += 4;
+                } else {
+                    appendNumber(out, p[i]);
+                }
+            }
+            out.push_back('m');
+            return true;
+        }
+
+        // Where the first byte renderColor might have to rewrite is, or text.end() if there is none.
+        std::string_view::iterator firstToRender(std::string_view text, MudColor color, bool utf8) {
+            bool escapes = color != MudColor::TrueColor, fold = !utf8;
+            if(!escapes && !fold) return text.end();
+            return std::find_if(text.begin(), text.end(), [&](char c) {
+                return (escapes && c == '\x1b') || (fold && (uint8_t)c >= 0x80);
+            });
+        }
+
+        struct CacheEntry {
+            std::size_t hash = 0;
+            uint8_t mode = 0;
+            std::string source;
+            // Null if the source renders as itself.
+            SharedBuffer result;
+            uint64_t used = 0;
+        };
+
+        // Long enough to be worth hashing, short enough that the cache stays small.
+        constexpr std::size_t cache_min = 128, cache_max = 8 * 1024;
+
+        struct RenderCache {
+            std::array<CacheEntry, 32> entries;
+            uint64_t clock = 0;
+
+            // The cached entry for text, or a fresh rendering of it in place of the least recently used.
+            const CacheEntry &get(std::string_view text, MudColor color, bool utf8) {
+                auto hash = std::hash<std::string_view>()(text);
+                auto mode = (uint8_t)(color | (utf8 << 2));
+                auto *victim = &entries[0];
+                for(auto &e : entries) {
+                    if(e.hash == hash && e.mode == mode && e.used && e.source == text) {
+                        e.used = ++clock;
+                        return e;
+                    }
+                    if(e.used < victim->used) victim = &e;
+                }
+                std::string out;
+                victim->result = renderColor(text, color, utf8, out)
+                        ? std::make_shared<const std::string>(std::move(out)) : nullptr;
+                victim->hash = hash;
+                victim->mode = mode;
+                victim->source.assign(text);
+                victim->used = ++clock;
+                return *victim;
+            }
+        };
+
+    }
+
+    uint8_t xtermFromRgb(uint8_t r, uint8_t g, uint8_t b) {
+        // The nearest cube colour and the nearest grey; whichever is closer.
+        auto cube = (uint8_t)(16 + 36 * cube_index[r] + 6 * cube_index[g] + cube_index[b]);
+        auto grey = (uint8_t)(232 + grey_index[(r + g + b) / 3]);
+        Rgb want{r, g, b};
+        return distance(xtermRgb(grey), want) < distance(xtermRgb(cube), want) ? grey : cube;
+    }
+
+    uint8_t ansiFromXterm(uint8_t index) {
+        return ansi_of_xterm[index];
+    }
+
+    bool renderColor(std::string_view text, MudColor color, bool utf8, std::string &out) {
+        bool escapes = color != MudColor::TrueColor, fold = !utf8;
+        auto needs = firstToRender(text, color, utf8);
+        if(needs == text.end()) return false;
+
+        auto start = out.size();
+        bool changed = false;
+        out.reserve(start + text.size());
+        out.append(text.begin(), needs);
+        for(std::size_t i = needs - text.begin(); i < text.size(); i++) {
+            auto c = (uint8_t)text[i];
+            if(escapes && c == 0x1b) {
+                // ESC [ params final, or ESC and one other byte.
+                auto begin = i;
+                if(i + 1 < text.size() && text[i + 1] == '[') {
+                    i += 2;
+                    while(i < text.size() && ((uint8_t)text[i] < 0x40 || (uint8_t)text[i] > 0x7e)) i++;
+                } else {
+                    i++;
+                }
+                if(color == MudColor::None) {
+                    changed = true;
+                    continue;
+                }
+                auto seq = text.substr(begin, std::min(i + 1, text.size()) - begin);
+                if(seq.size() > 3 && seq[1] == '[' && seq.back() == 'm' &&
+                   rewriteSgr(seq.substr(2, seq.size() - 3), color, out)) {
+                    changed = true;
+                } else {
+                    out.append(seq);
+                }
+                continue;
+            }
+            if(fold && c >= 0x80) {
+                // One ? per UTF-8 sequence; continuation bytes are dropped.
+                if(c >= 0xc0) out.push_back('?');
+                changed = true;
+                continue;
+            }
+            out.push_back((char)c);
+        }
+        if(!changed) out.resize(start);
+        return changed;
+    }
+
+    std::string_view renderText(std::string_view text, MudColor color, bool utf8, RenderScratch &scratch) {
+        // Plain text, the common case, is neither hashed nor copied into the cache.
+        if(firstToRender(text, color, utf8) == text.end()) return text;
+        if(text.size() < cache_min || text.size() > cache_max) {
+            return renderColor(text, color, utf8, scratch.local) ? std::string_view(scratch.local) : text;
+        }
+        // Each I/O thread (and the game thread, for broadcasts) keeps its own.
+        thread_local RenderCache cache;
+        scratch.cached = cache.get(text, color, utf8).result;
+        return scratch.cached ? std::string_view(*scratch.cached) : text;
+    }
+
+}
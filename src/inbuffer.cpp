@@ -0,0 +1,59 @@
+#include "mudlink/inbuffer.hpp"
+#include "mudlink/pool.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace mudlink {
+
+    InputBuffer::~InputBuffer() {
+        release();
+    }
+
+    boost::asio::mutable_buffer InputBuffer::prepare(std::size_t len) {
+        auto used = end - begin;
+        if(end + len > cap) {
+            if(block && used + len <= cap) {
+                // Enough room once the unparsed tail is moved to the front.
+                std::memmove(block, block + begin, used);
+            } else {
+                auto want = std::max(used + len, cap * 2);
+                auto grown = static_cast<char*>(BufferPool::acquire(want));
+                if(used) std::memcpy(grown, block + begin, used);
+                BufferPool::release(block, cap);
+                block = grown;
+                cap = want;
+            }
+            begin = 0;
+            end = used;
+        }
+        return {block + end, len};
+    }
+
+    void InputBuffer::commit(std::size_t len) {
+        end += len;
+    }
+
+    boost::asio::const_buffer InputBuffer::data() const {
+        return {block + begin, end - begin};
+    }
+
+    void InputBuffer::consume(std::size_t len) {
+        begin += std::min(len, end - begin);
+        if(begin == end) release();
+    }
+
+    std::size_t InputBuffer::size() const {
+        return end - begin;
+    }
+
+    std::size_t InputBuffer::capacity() const {
+        return cap;
+    }
+
+    void InputBuffer::release() {
+        BufferPool::release(block, cap);
+        block = nullptr;
+        cap = begin = end = 0;
+    }
+
+}
@@ -0,0 +1,68 @@
+#include "mudlink/iopool.hpp"
+#include <algorithm>
+
+namespace mudlink {
+
+    IoPool::IoPool(boost::asio::io_context &fallback) : fallback(fallback), fallback_wheel(fallback) {
+
+    }
+
+    IoPool::~IoPool() {
+        stop();
+    }
+
+    void IoPool::start(std::size_t count) {
+        if(!contexts.empty()) return;
+        if(count == 0) count = std::max(1u, std::thread::hardware_concurrency());
+        for(std::size_t i = 0; i < count; i++) {
+            // Each context is only ever run by one thread, which lets asio skip some locking.
+            contexts.push_back(std::make_unique<boost::asio::io_context>(1));
+            guards.emplace_back(contexts.back()->get_executor());
+            wheels.push_back(std::make_unique<TimerWheel>(*contexts.back()));
+        }
+        for(auto &c : contexts) {
+            threads.emplace_back([ctx = c.get()] { ctx->run(); });
+        }
+    }
+
+    void IoPool::join() {
+        guards.clear();
+        for(auto &c : contexts) c->stop();
+        for(auto &t : threads) t.join();
+        threads.clear();
+    }
+
+    void IoPool::stop() {
+        join();
+        for(auto &w : wheels) w->stop();
+        fallback_wheel.stop();
+        contexts.clear();
+        wheels.clear();
+    }
+
+    boost::asio::io_context& IoPool::next() {
+        if(contexts.empty()) return fallback;
+        return *contexts[cursor.fetch_add(1, std::memory_order_relaxed) % contexts.size()];
+    }
+
+    boost::asio::io_context& IoPool::get(std::size_t index) {
+        if(contexts.empty()) return fallback;
+        return *contexts[index % contexts.size()];
+    }
+
+    bool IoPool::owns(const boost::asio::execution_context &ctx) const {
+        return std::any_of(contexts.begin(), contexts.end(), [&](const auto &c) { return c.get() == &ctx; });
+    }
+
+    TimerWheel& IoPool::wheel(const boost::asio::execution_context &ctx) {
+        for(std::size_t i = 0; i < contexts.size(); i++) {
+            if(contexts[i].get() == &ctx) return *wheels[i];
+        }
+        return fallback_wheel;
+    }
+
+    std::size_t IoPool::size() const {
+        return contexts.empty() ? 1 : contexts.size();
+    }
+
+}
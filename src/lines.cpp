@@ -0,0 +1,43 @@
+#include "mudlink/lines.hpp"
+
+namespace mudlink {
+
+    namespace {
+        // Buffers that grew past this to hold a long line are given back once it is done with.
+        constexpr std::size_t keep_capacity = 1024;
+
+        constexpr bool isBlank(char c) {
+            switch(c) {
+                case ' ': case '\t': case '\r': case '\n': case '\v': case '\f': case '\0':
+                    return true;
+                default:
+                    return false;
+            }
+        }
+    }
+
+    std::string_view trimLine(std::string_view line) {
+        std::size_t begin = 0, end = line.size();
+        while(begin < end && isBlank(line[begin])) begin++;
+        while(end > begin && isBlank(line[end - 1])) end--;
+        return line.substr(begin, end - begin);
+    }
+
+    LineAssembler::LineAssembler(std::size_t max_length) : max_length(max_length) {
+
+    }
+
+    std::size_t LineAssembler::pending() const {
+        return buf.size();
+    }
+
+    void LineAssembler::reset() {
+        overflowed = false;
+        if(buf.capacity() > keep_capacity) {
+            std::string().swap(buf);
+        } else {
+            buf.clear();
+        }
+    }
+
+}
@@ -0,0 +1,229 @@
+#include "mudlink/mccp.hpp"
+#include <algorithm>
+#include <new>
+
+namespace mudlink {
+
+    namespace {
+        // zlib's own estimate of what deflate needs, plus slack for its state struct.
+        constexpr std::size_t deflateMemory(int window_bits, int mem_level) {
+            return (std::size_t(1) << (window_bits + 2)) + (std::size_t(1) << (mem_level + 9)) + 8192;
+        }
+
+        // Each allocation is prefixed with its size so release() can account for it.
+        constexpr std::size_t header = alignof(std::max_align_t);
+    }
+
+    double CompressionStats::ratio() const {
+        auto in = bytes_in.load(std::memory_order_relaxed);
+        if(!in) return 1.0;
+        return (double)bytes_out.load(std::memory_order_relaxed) / (double)in;
+    }
+
+    ZlibStream::ZlibStream(const CompressionConfig &cfg, CompressionBudget &budget, CompressionStats &stats)
+        : config(cfg), budget(budget), stats(stats) {
+        zs.zalloc = alloc;
+        zs.zfree = release;
+        zs.opaque = this;
+    }
+
+    ZlibStream::~ZlibStream() {
+        // Whatever zlib never came to use.
+        used -= reserved;
+        budget.used.fetch_sub(reserved);
+    }
+
+    std::size_t ZlibStream::memory() const {
+        return used;
+    }
+
+    bool ZlibStream::reserve(std::size_t bytes) {
+        if(used + bytes > config.max_memory) return false;
+        if(budget.used.fetch_add(bytes) + bytes > budget.limit) {
+            budget.used.fetch_sub(bytes);
+            return false;
+        }
+        used += bytes;
+        reserved += bytes;
+        return true;
+    }
+
+    Compressor::Compressor(const CompressionConfig &cfg, CompressionBudget &budget, CompressionStats &stats)
+        : ZlibStream(cfg, budget, stats), level(cfg.level) {
+
+    }
+
+    Compressor::~Compressor() {
+        if(started) deflateEnd(&zs);
+    }
+
+    voidpf ZlibStream::alloc(voidpf opaque, uInt items, uInt size) {
+        auto self = static_cast<ZlibStream*>(opaque);
+        auto bytes = (std::size_t)items * size + header;
+        if(bytes <= self->reserved) {
+            // Already accounted for.
+            auto mem = static_cast<char*>(::operator new(bytes, std::nothrow));
+            if(!mem) return Z_NULL;
+            self->reserved -= bytes;
+            *reinterpret_cast<std::size_t*>(mem) = bytes;
+            return mem + header;
+        }
+        if(self->used + bytes > self->config.max_memory) return Z_NULL;
+        if(self->budget.used.fetch_add(bytes) + bytes > self->budget.limit) {
+            self->budget.used.fetch_sub(bytes);
+            return Z_NULL;
+        }
+        auto mem = static_cast<char*>(::operator new(bytes, std::nothrow));
+        if(!mem) {
+            self->budget.used.fetch_sub(bytes);
+            return Z_NULL;
+        }
+        self->used += bytes;
+        *reinterpret_cast<std::size_t*>(mem) = bytes;
+        return mem + header;
+    }
+
+    void ZlibStream::release(voidpf opaque, voidpf ptr) {
+        auto self = static_cast<ZlibStream*>(opaque);
+        auto mem = static_cast<char*>(ptr) - header;
+        auto bytes = *reinterpret_cast<std::size_t*>(mem);
+        self->used -= bytes;
+        self->budget.used.fetch_sub(bytes);
+        ::operator delete(mem);
+    }
+
+    bool Compressor::start() {
+        if(started) return true;
+        auto window = config.window_bits, mem = config.mem_level;
+        while(deflateMemory(window, mem) > config.max_memory && (window > 9 || mem > 1)) {
+            if(mem > 1 && (mem > window - 7 || window == 9)) mem--;
+            else window--;
+        }
+        started = deflateInit2(&zs, level, Z_DEFLATED, window, mem, Z_DEFAULT_STRATEGY) == Z_OK;
+        return started;
+    }
+
+    void Compressor::compress(OutputQueue &in, OutputQueue &out, bool finish) {
+        auto start_time = std::chrono::steady_clock::now();
+        auto total = in.size();
+
+        // Small flushes aren't worth the CPU; send them as stored blocks.
+        auto want = total < config.min_flush && !finish ? Z_NO_COMPRESSION : config.level;
+        if(want != level) {
+            // Anything zlib still holds is compressed under the old level first. Without the room
+            // for it the level stays as it was (Z_BUF_ERROR), so retry with more, or switch next time.
+            auto rc = Z_BUF_ERROR;
+            for(std::size_t room = 64; rc == Z_BUF_ERROR && room <= 64 * 1024; room *= 4) {
+                auto reserve = out.prepare(room);
+                zs.next_out = reinterpret_cast<Bytef*>(reserve);
+                zs.avail_out = (uInt)room;
+                rc = deflateParams(&zs, want, Z_DEFAULT_STRATEGY);
+                auto produced = room - zs.avail_out;
+                out.commit(produced);
+                stats.bytes_out.fetch_add(produced, std::memory_order_relaxed);
+            }
+            if(rc == Z_OK) level = want;
+        }
+
+        auto &bufs = scratch;
+        bufs.clear();
+        in.gather(bufs, SIZE_MAX);
+        for(std::size_t i = 0; i < bufs.size(); i++) {
+            auto last = i + 1 == bufs.size();
+            deflateInto(out, static_cast<const char*>(bufs[i].data()), bufs[i].size(),
+                        last ? (finish ? Z_FINISH : Z_SYNC_FLUSH) : Z_NO_FLUSH);
+        }
+        if(bufs.empty() && finish) deflateInto(out, nullptr, 0, Z_FINISH);
+        in.consume(total);
+
+        stats.bytes_in.fetch_add(total, std::memory_order_relaxed);
+        stats.cpu_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start_time).count(), std::memory_order_relaxed);
+    }
+
+    void Compressor::deflateInto(OutputQueue &out, const char *data, std::size_t len, int flush) {
+        zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        zs.avail_in = (uInt)len;
+        while(true) {
+            auto room = std::max<std::size_t>(deflateBound(&zs, zs.avail_in) + 16, 256);
+            auto buf = out.prepare(room);
+            zs.next_out = reinterpret_cast<Bytef*>(buf);
+            zs.avail_out = (uInt)room;
+            auto rc = deflate(&zs, flush);
+            auto produced = room - zs.avail_out;
+            out.commit(produced);
+            stats.bytes_out.fetch_add(produced, std::memory_order_relaxed);
+            // Done once all input is taken and zlib had output space to spare.
+            if(rc == Z_STREAM_END || rc == Z_STREAM_ERROR) break;
+            if(zs.avail_in == 0 && zs.avail_out != 0) break;
+        }
+    }
+
+    Decompressor::Decompressor(const CompressionConfig &cfg, CompressionBudget &budget, CompressionStats &stats)
+        : ZlibStream(cfg, budget, stats) {
+
+    }
+
+    Decompressor::~Decompressor() {
+        if(started) inflateEnd(&zs);
+    }
+
+    bool Decompressor::start() {
+        if(started) return true;
+        // The client picks the window, so we have to be ready for the largest. inflate only
+        // allocates it once input arrives, so it is reserved here, after the state: running out
+        // mid-stream would cost the client its connection.
+        if(inflateInit2(&zs, 15) != Z_OK) return false;
+        constexpr std::size_t window = (std::size_t(1) << 15) + 64 + header;
+        if(!reserve(window)) {
+            inflateEnd(&zs);
+            return false;
+        }
+        started = true;
+        return started;
+    }
+
+    InflateStatus Decompressor::decompress(std::string_view &in, InputBuffer &out) {
+        auto start_time = std::chrono::steady_clock::now();
+        auto status = InflateStatus::Ok;
+        zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+        zs.avail_in = (uInt)in.size();
+        // Inflated a chunk at a time, so a bomb is caught before it can grow out much.
+        constexpr std::size_t chunk = 4096;
+        while(true) {
+            auto buf = out.prepare(chunk);
+            zs.next_out = static_cast<Bytef*>(buf.data());
+            zs.avail_out = (uInt)chunk;
+            auto rc = inflate(&zs, Z_SYNC_FLUSH);
+            auto produced = chunk - zs.avail_out;
+            out.commit(produced);
+            stats.bytes_out.fetch_add(produced, std::memory_order_relaxed);
+            if(rc == Z_STREAM_END) {
+                status = InflateStatus::Finished;
+                break;
+            }
+            if(rc == Z_MEM_ERROR) {
+                status = InflateStatus::OutOfMemory;
+                break;
+            }
+            if(rc != Z_OK && rc != Z_BUF_ERROR) {
+                status = InflateStatus::Failed;
+                break;
+            }
+            if(zs.total_out > config.ratio_grace && zs.total_out > zs.total_in * config.max_ratio) {
+                status = InflateStatus::Failed;
+                break;
+            }
+            // Z_BUF_ERROR only means there was nothing left to do.
+            if(rc == Z_BUF_ERROR || (zs.avail_in == 0 && zs.avail_out != 0)) break;
+        }
+        auto taken = in.size() - zs.avail_in;
+        in.remove_prefix(taken);
+
+        stats.bytes_in.fetch_add(taken, std::memory_order_relaxed);
+        stats.cpu_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start_time).count(), std::memory_order_relaxed);
+        return status;
+    }
+
+}
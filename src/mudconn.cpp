@@ -4,154 +4,619 @@
 
 #include "mudlink/mudconn.hpp"
 
+#include <algorithm>
 #include <utility>
+#if defined(__linux__)
+#include <netinet/tcp.h>
+#endif
 
 namespace mudlink {
 
-    MudConnection::MudConnection(ConnQueue &cq, uint32_t id) : cqueue(cq) {
+    OobMessage::OobMessage(std::string_view package, std::string_view payload) {
+        raw.reserve(package.size() + payload.size());
+        raw.append(package);
+        raw.append(payload);
+        split = package.size();
+    }
+
+    std::string_view OobMessage::package() const {
+        return std::string_view(raw).substr(0, split);
+    }
+
+    std::string_view OobMessage::payload() const {
+        return std::string_view(raw).substr(split);
+    }
+
+    uint8_t RenderClass::pack() const {
+        return (uint8_t)(protocol | (color << 1) | (utf8 << 3) | (prompt << 4) | (oob << 6));
+    }
+
+    RenderClass RenderClass::unpack(uint8_t key) {
+        RenderClass out;
+        out.protocol = (ProtocolType)(key & 1);
+        out.color = (MudColor)((key >> 1) & 3);
+        out.utf8 = (key >> 3) & 1;
+        out.prompt = (PromptEnd)((key >> 4) & 3);
+        out.oob = (OobMode)((key >> 6) & 3);
+        return out;
+    }
+
+    MsgToMud::MsgToMud(ToMudEvent mt, EventData d) : mtype(mt), data(std::move(d)) {
+
+    }
+
+    MsgFromMud::MsgFromMud(FromMudEvent mt, EventData d) : mtype(mt), data(std::move(d)) {
+
+    }
+
+    MudConnection::MudConnection(ConnQueue &cq, uint32_t id, TcpSocket sock)
+        : out_events(cq.event_capacity), in_events(cq.event_capacity), cqueue(cq), exec(sock.get_executor()),
+          wheel(cq.wheel(boost::asio::query(exec, boost::asio::execution::context))), transport(std::move(sock)),
+          activity_timer(wheel, &onStrand<MudConnection, &MudConnection::checkActivity>, this),
+          flush_timer(wheel, &onStrand<MudConnection, &MudConnection::flushDelayed>, this) {
         this->conn_id = id;
     }
 
+    void MudConnection::updateRenderClass() {
+        RenderClass rc;
+        rc.protocol = cap.protocol;
+        rc.color = cap.color;
+        rc.utf8 = cap.utf8;
+        render_class.store(rc.pack());
+    }
+
     bool MudConnection::isTLS() const {
         return scon != nullptr;
     }
 
-    void MudConnection::sendToMud(MsgToMud &m) {
-        if(active) {
-            in_mut.lock();
-            in_events.push_back(m);
-            in_mut.unlock();
-        } else {
-            pending_events.push_back(m);
+    void MudConnection::sendToMud(MsgToMud &&m) {
+        if(!active) {
+            pending_events.push_back(std::move(m));
+            return;
+        }
+        if(!in_overflow.empty()) flushInbound();
+        if(!in_overflow.empty() || !in_events.push(std::move(m))) {
+            in_overflow.push_back(std::move(m));
+            in_stalled.store(true);
         }
+        notifyInbound();
     }
 
-    MudConnection::~MudConnection() {
-        if(isTLS()) {
-            if(wsock) {
-                delete conn.tls_websocket;
-            } else {
-                delete conn.secure_peer;
+    void MudConnection::flushInbound() {
+        auto moved = in_events.pushBatch(in_overflow.begin(), in_overflow.end());
+        in_overflow.erase(in_overflow.begin(), in_overflow.begin() + (std::ptrdiff_t)moved);
+        if(moved) notifyInbound();
+        if(in_overflow.empty()) {
+            std::vector<MsgToMud>().swap(in_overflow);
+            in_stalled.store(false);
+            if(read_paused) {
+                read_paused = false;
+                // What was held back was input all the same.
+                noteInput();
+                receive();
             }
-        } else {
-            if(wsock) {
-                delete conn.websocket;
-            } else {
-                delete conn.peer;
+        }
+    }
+
+    bool MudConnection::holdInput() {
+        if(in_overflow.empty()) return false;
+        read_paused = true;
+        return true;
+    }
+
+    void MudConnection::trim() {
+        in_events.trim();
+    }
+
+    void MudConnection::notifyInbound() {
+        // Pairs with the fence in ConnQueue::drainInbound, so either it sees our events or we see in_flagged cleared.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(!in_flagged.exchange(true)) {
+            cqueue.in_ready.push(conn_id);
+            if(cqueue.on_inbound) cqueue.on_inbound();
+        }
+    }
+
+    void MudConnection::processOutbound() {
+        out_flagged.store(false);
+        // Pairs with the fence in ConnQueue::send; anything pushed before it saw out_flagged set is drained here.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool disconnect = false, prompt = false;
+        out_events.popBatch([&](MsgFromMud &&ev) {
+            if(disconnect) return;
+            prompt = prompt || ev.mtype == FromMudEvent::Prompt;
+            if(ev.mtype == FromMudEvent::Disconnect) {
+                disconnect = true;
+                // Variables set before it still go out.
+                flushOob();
             }
+            processFromMud(std::move(ev));
+        });
+        // A backlogged connection may keep its variables until it catches up.
+        bool collapse = backlogged.load(std::memory_order_relaxed) && (cqueue.backpressure.policy & CollapseOob);
+        if(!disconnect && !collapse) flushOob();
+        // Whatever the batch queued goes out together, unless it can wait for the next few.
+        auto &policy = cqueue.flush;
+        if(disconnect || prompt || !policy.max_delay.count() || bufferedBytes() >= policy.max_pending) {
+            send();
+        } else if(!delayed) {
+            delayed = true;
+            flush_timer.schedule(policy.max_delay);
+        }
+        if(disconnect) {
+            cqueue.remove(conn_id);
         }
     }
 
     void MudConnection::onPlainConnect() {
         start();
+        receive();
     }
 
     void MudConnection::onSecureConnect() {
         start();
+        receive();
     }
 
     void MudConnection::onConnect() {
+        last_input = last_output = std::chrono::steady_clock::now();
+        if(cqueue.flush.nodelay) {
+            boost::system::error_code ec;
+            socket().set_option(boost::asio::ip::tcp::no_delay(true), ec);
+        }
+        armActivity();
         if(isTLS()) {
-            auto old = conn.peer;
-            conn.secure_peer = new TlsSocket(std::move(*old), *scon);
-            delete old;
-            conn.secure_peer->async_handshake(boost::asio::ssl::stream_base::server, [&](std::error_code ec){
+            auto sock = std::move(std::get<TcpSocket>(transport));
+            auto &tls = transport.emplace<TlsSocket>(std::move(sock), *scon);
+            tls.async_handshake(boost::asio::ssl::stream_base::server, [this, self = shared_from_this()](std::error_code ec) {
                 if(!ec) {
                     onSecureConnect();
+                } else {
+                    abort(ec.message());
                 }});
         } else {
             onPlainConnect();
         }
     }
 
+    void MudConnection::beginCompression(std::unique_ptr<Compressor> c) {
+        // Anything queued before this point goes out as it is.
+        outbox.moveTo(wirebox);
+        compressor = std::move(c);
+    }
+
+    void MudConnection::endCompression() {
+        if(!compressor) return;
+        compressor->compress(outbox, wirebox, true);
+        compressor.reset();
+        send();
+    }
+
+    bool MudConnection::beginDecompression(std::unique_ptr<Decompressor> d) {
+        // Whatever followed the handshake in the last read is already compressed.
+        auto left = inbox.data();
+        rawbox.commit(boost::asio::buffer_copy(rawbox.prepare(left.size()), left));
+        inbox.consume(left.size());
+        decompressor = std::move(d);
+        return inflateInbound();
+    }
+
+    bool MudConnection::inflateInbound() {
+        auto raw = rawbox.data();
+        std::string_view in(static_cast<const char*>(raw.data()), raw.size());
+        switch(decompressor->decompress(in, inbox)) {
+            case InflateStatus::Failed:
+                abort("compressed input was corrupt or expanded too far");
+                return false;
+            case InflateStatus::OutOfMemory:
+                abort("out of memory for compressed input");
+                return false;
+            case InflateStatus::Finished:
+                // The client ended compression; the rest is plain.
+                decompressor.reset();
+                inbox.commit(boost::asio::buffer_copy(inbox.prepare(in.size()), boost::asio::buffer(in)));
+                in = {};
+                break;
+            default:
+                break;
+        }
+        rawbox.consume(raw.size() - in.size());
+        return true;
+    }
+
+    void MudConnection::shutdown() {
+        if(closed) return;
+        closing = true;
+        send();
+    }
+
+    void MudConnection::close() {
+        if(closed) return;
+        closed = true;
+        // OpenSSL drops a session from its cache if the connection ends without a close_notify,
+        // which would make every client that resumes by session id do a full handshake next time.
+        std::visit([](auto &stream) {
+            using Stream = std::decay_t<decltype(stream)>;
+            SSL *ssl = nullptr;
+            if constexpr(std::is_same_v<Stream, TlsSocket>) ssl = stream.native_handle();
+            if constexpr(std::is_same_v<Stream, TlsWebSocket>) ssl = stream.next_layer().native_handle();
+            if(ssl && SSL_is_init_finished(ssl)) SSL_set_shutdown(ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+        }, transport);
+        boost::system::error_code ec;
+        socket().close(ec);
+        // Whatever is still buffered will never go, so it no longer counts.
+        updateBacklog();
+    }
+
+    void MudConnection::abort(std::string_view reason) {
+        if(closed) return;
+        close();
+        if(active) {
+            // The connection is unregistered once the game has collected this.
+            sendToMud(MsgToMud(ToMudEvent::Disconnected, std::string(reason)));
+        } else {
+            // The game never heard of it.
+            cqueue.remove(conn_id);
+        }
+    }
+
+    TcpSocket& MudConnection::socket() {
+        return std::visit([](auto &stream) -> TcpSocket& { return boost::beast::get_lowest_layer(stream); }, transport);
+    }
+
+    void MudConnection::keepAlive() {
+
+    }
+
+    void MudConnection::flushOob() {
+
+    }
+
+    std::size_t MudConnection::bufferedBytes() const {
+        return outbox.size() + wirebox.size();
+    }
+
+    void MudConnection::updateBacklog() {
+        auto bytes = closed ? 0 : bufferedBytes();
+        if(bytes != accounted) {
+            // Wraps around as it should when bytes is the smaller.
+            cqueue.buffered_bytes.fetch_add(bytes - accounted, std::memory_order_relaxed);
+            accounted = bytes;
+        }
+        if(closed) return;
+        auto &bp = cqueue.backpressure;
+        if(bytes > bp.max_buffered) {
+            abort("too much output buffered");
+        } else if(!backlogged.load(std::memory_order_relaxed)) {
+            if(bytes < bp.high_watermark) return;
+            if(bp.policy & DisconnectSlow) {
+                abort("client is not keeping up with its output");
+                return;
+            }
+            backlogged.store(true, std::memory_order_relaxed);
+        } else if(bytes <= bp.low_watermark) {
+            backlogged.store(false, std::memory_order_relaxed);
+            if(!(bp.policy & CollapseOob)) return;
+            // What the OOB variables were held back for. Only their latest values go.
+            flushOob();
+            send();
+        }
+    }
+
+    void MudConnection::flushDelayed() {
+        delayed = false;
+        send();
+    }
+
+    void MudConnection::checkActivity() {
+        auto &t = cqueue.timers;
+        auto now = std::chrono::steady_clock::now();
+        // While reading is paused for the game to catch up, the client is anything but idle.
+        auto input = read_paused ? now : last_input;
+        if(t.idle.count() && now - input >= t.idle) {
+            abort("idle timeout");
+            return;
+        }
+        if(t.afk.count() && active && !afk && now - input >= t.afk) {
+            afk = true;
+            sendToMud(MsgToMud(ToMudEvent::Afk));
+        }
+        if(t.keepalive.count() && !isWriting && now - last_output >= t.keepalive) {
+            keepAlive();
+            last_output = now;
+        }
+        armActivity();
+    }
+
+    void MudConnection::armActivity() {
+        auto &t = cqueue.timers;
+        auto now = std::chrono::steady_clock::now();
+        auto next = std::chrono::steady_clock::time_point::max();
+        auto input = read_paused ? now : last_input;
+        if(t.idle.count()) next = std::min(next, input + t.idle);
+        // Until the game has heard of the connection it can't be away, so just look again later.
+        if(t.afk.count() && !afk) next = std::min(next, (active ? input : now) + t.afk);
+        // A write still in flight is as good as output; a stalled one isn't polled.
+        if(t.keepalive.count()) next = std::min(next, (isWriting ? now : last_output) + t.keepalive);
+        if(next == std::chrono::steady_clock::time_point::max()) return;
+        auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(next - now);
+        activity_timer.schedule(std::max(delay, std::chrono::milliseconds(0)));
+    }
+
+    void MudConnection::noteInput() {
+        last_input = std::chrono::steady_clock::now();
+        if(afk) {
+            afk = false;
+            armActivity();
+        }
+    }
+
     void MudConnection::send() {
+        if(!outbox.empty()) {
+            if(compressor) {
+                compressor->compress(outbox, wirebox);
+            } else {
+                outbox.moveTo(wirebox);
+            }
+        }
+
+        updateBacklog();
+        if(isWriting || closed) return;
+        if(wirebox.empty()) {
+            if(closing) close();
+            return;
+        }
+        isWriting = true;
+        write_bufs.clear();
+        wirebox.gather(write_bufs);
+        auto handler = [this, self = shared_from_this()](std::error_code ec, std::size_t len) {
+            wirebox.consume(len);
+            isWriting = false;
+            last_output = std::chrono::steady_clock::now();
+            if(!ec) {
+                if(corked && wirebox.empty() && outbox.empty()) cork(false);
+                send();
+            } else {
+                abort(ec.message());
+            }
+        };
+        // More than one write's worth (and a TLS write only takes a record), so cork until the rest is out.
+        auto one_write = boost::asio::buffer_size(write_bufs);
+        if(isTLS()) one_write = std::min<std::size_t>(one_write, 16 * 1024);
+        if(cqueue.flush.cork && !corked && wirebox.size() > one_write) cork(true);
+        std::visit([&](auto &stream) {
+            if constexpr(isByteStream<std::decay_t<decltype(stream)>>) stream.async_write_some(write_bufs, std::move(handler));
+        }, transport);
+    }
 
-        if(!isWriting) {
-            if(outbox.size() > 0) {
-                isWriting = true;
-                auto handler = [&](std::error_code ec, std::size_t len){
-                    outbox.consume(len);
-                    if(outbox.size() > 0) {
-                        send();
-                    } else {
-                        isWriting = false;
+    void MudConnection::cork(bool on) {
+        corked = on;
+#if defined(TCP_CORK)
+        boost::system::error_code ec;
+        socket().set_option(boost::asio::detail::socket_option::boolean<IPPROTO_TCP, TCP_CORK>(on), ec);
+#endif
+    }
+
+    void MudConnection::receive() {
+        if(closed || holdInput()) return;
+        // Most connections sit idle most of the time, so wait for input before taking a buffer for
+        // it. TLS may already hold decrypted bytes the socket won't signal, so it reads straight away.
+        std::visit([&](auto &stream) {
+            using Stream = std::decay_t<decltype(stream)>;
+            if constexpr(isByteStream<Stream>) {
+                if constexpr(std::is_same_v<Stream, TlsSocket>) {
+                    if(SSL_pending(stream.native_handle()) > 0) {
+                        readSome();
+                        return;
                     }
-                };
-                if(isTLS()) {
-                    conn.secure_peer->async_write_some(outbox.data(), handler);
-                } else {
-                    conn.peer->async_write_some(outbox.data(), handler);
                 }
+                boost::beast::get_lowest_layer(stream).async_wait(TcpSocket::wait_read,
+                        [this, self = shared_from_this()](boost::system::error_code ec) {
+                    if(ec) {
+                        abort(ec.message());
+                        return;
+                    }
+                    readSome();
+                });
             }
-        }
+        }, transport);
     }
 
-    void MudConnection::receive() {
-        auto x = inbox.prepare(1024);
-        auto handler = [&](std::error_code ec, std::size_t length) {
-            if(!ec) {
+    void MudConnection::readSome() {
+        if(closed) return;
+        // While decompressing, reads land in rawbox and are inflated into inbox from there.
+        bool raw = decompressor != nullptr;
+        auto x = (raw ? rawbox : inbox).prepare(4096);
+        auto handler = [this, self = shared_from_this(), raw](boost::system::error_code ec, std::size_t length) {
+            if(ec) {
+                abort(ec == boost::asio::error::eof ? "connection closed" : ec.message());
+                return;
+            }
+            noteInput();
+            if(raw) {
+                rawbox.commit(length);
+                if(!inflateInbound()) return;
+            } else {
                 inbox.commit(length);
-                onReceive();
-                receive();
-            } else
-            {
-                std::cout << "something went wrong" << std::endl << std::flush;
             }
+            onReceive();
+            // Replies to whatever was read go out together.
+            send();
+            receive();
         };
-        if(isTLS()) {
-            conn.secure_peer->async_read_some(x, handler);
-        } else {
-            conn.peer->async_read_some(x, handler);
-        }
+        std::visit([&](auto &stream) {
+            if constexpr(isByteStream<std::decay_t<decltype(stream)>>) stream.async_read_some(x, std::move(handler));
+        }, transport);
     }
 
-    ConnQueue::ConnQueue(boost::asio::io_context &con) : io_con(con) {
+    ConnQueue::ConnQueue(boost::asio::io_context &con, std::size_t max_connections)
+        : max_connections(max_connections), io_con(con), pool(con), tls_pool(con), in_ready(max_connections) {
 
     }
 
-    bool ConnQueue::send(uint32_t id, MsgFromMud &ev) {
-        if(connections.contains(id)) {
-            mut.lock();
-            auto conn = connections[id];
-            conn->out_mut.lock();
-            conn->out_events.push_back(ev);
-            conn->out_mut.unlock();
-            out_ready[id] = conn;
-            mut.unlock();
-            return true;
-        } else {
+    ConnQueue::~ConnQueue() {
+        // I/O threads may still be running handlers that touch in_ready and friends, which are
+        // destroyed before pool. Stop them first, and let go of the connections while the
+        // contexts their sockets belong to are still around.
+        pool.join();
+        tls_pool.join();
+        connections.clear();
+        tls_pool.stop();
+        pool.stop();
+    }
+
+    TimerWheel& ConnQueue::wheel(const boost::asio::execution_context &ctx) {
+        return tls_pool.owns(ctx) ? tls_pool.wheel(ctx) : pool.wheel(ctx);
+    }
+
+    bool ConnQueue::add(std::shared_ptr<MudConnection> conn) {
+        std::unique_lock lock(mut);
+        if(connections.size() >= max_connections) {
             return false;
         }
+        auto id = conn->conn_id;
+        connections[id] = std::move(conn);
+        return true;
+    }
+
+    void ConnQueue::remove(uint32_t id) {
+        std::shared_ptr<MudConnection> conn;
+        {
+            std::unique_lock lock(mut);
+            auto found = connections.find(id);
+            if(found == connections.end()) return;
+            conn = std::move(found->second);
+            connections.erase(found);
+        }
+        postTo(conn, &MudConnection::shutdown);
+    }
+
+    SendStatus ConnQueue::send(uint32_t id, MsgFromMud &&ev) {
+        std::shared_lock lock(mut);
+        auto found = connections.find(id);
+        if(found == connections.end()) {
+            return SendStatus::NotFound;
+        }
+        return queue(found->second.get(), std::move(ev));
+    }
+
+    SendStatus ConnQueue::queue(MudConnection *conn, MsgFromMud &&ev) {
+        bool backlogged = conn->backlogged.load(std::memory_order_relaxed);
+        if(backlogged && (backpressure.policy & DropText) &&
+           (ev.mtype == FromMudEvent::Line || ev.mtype == FromMudEvent::Text)) {
+            return SendStatus::Dropped;
+        }
+        if(!conn->out_events.push(std::move(ev))) {
+            return SendStatus::Full;
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(!conn->out_flagged.exchange(true)) {
+            out_ready.push_back(conn->conn_id);
+        }
+        return backlogged ? SendStatus::Backlogged : SendStatus::Queued;
+    }
+
+    SendStatus ConnQueue::queueShared(MudConnection *conn, const MsgFromMud &ev) {
+        // Variables are kept per connection, so each gets its own copy.
+        if(ev.mtype == FromMudEvent::OobVar) {
+            if(auto oob = std::get_if<OobMessage>(&ev.data)) return queue(conn, MsgFromMud(ev.mtype, *oob));
+            return SendStatus::Dropped;
+        }
+        auto key = conn->render_class.load(std::memory_order_relaxed);
+        auto cached = std::find_if(shared_cache.begin(), shared_cache.end(),
+                                   [key](const auto &c) { return c.first == key; });
+        if(cached == shared_cache.end()) {
+            shared_cache.emplace_back(key, conn->encodeShared(ev, RenderClass::unpack(key)));
+            cached = shared_cache.end() - 1;
+        }
+        if(!cached->second) {
+            return queue(conn, MsgFromMud(ev.mtype));
+        }
+        return queue(conn, MsgFromMud(ev.mtype, cached->second));
+    }
+
+    std::size_t ConnQueue::broadcast(const std::vector<uint32_t> &ids, MsgFromMud &&ev) {
+        std::size_t count = 0;
+        {
+            std::shared_lock lock(mut);
+            for(auto id : ids) {
+                auto found = connections.find(id);
+                if(found != connections.end() && queued(queueShared(found->second.get(), ev))) count++;
+            }
+        }
+        shared_cache.clear();
+        return count;
+    }
+
+    std::size_t ConnQueue::drainInbound(std::vector<InboundEvent> &out, std::size_t per_conn) {
+        std::size_t count = 0;
+        {
+            std::shared_lock lock(mut);
+            in_ready.popBatch([&](uint32_t &&id) {
+                auto found = connections.find(id);
+                if(found == connections.end()) return;
+                auto &conn = found->second;
+                count += conn->in_events.popBatch([&](MsgToMud &&ev) {
+                    if(ev.mtype == ToMudEvent::Disconnected) gone.push_back(id);
+                    out.emplace_back(id, std::move(ev));
+                }, per_conn);
+
+                if(conn->in_stalled.load()) {
+                    // The I/O side is holding events that didn't fit; now there is room for them.
+                    postTo(conn, &MudConnection::flushInbound);
+                }
+
+                if(!conn->in_events.empty()) {
+                    // Over budget. It stays flagged and goes to the back of the line.
+                    carried.push_back(id);
+                    return;
+                }
+                conn->in_flagged.store(false);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if(!conn->in_events.empty() && !conn->in_flagged.exchange(true)) {
+                    carried.push_back(id);
+                }
+            });
+        }
+        for(auto id : carried) in_ready.push(id);
+        carried.clear();
+        if(!gone.empty()) {
+            // Closed by the I/O side, and now the game knows. Nothing else will come from them.
+            std::unique_lock lock(mut);
+            for(auto id : gone) connections.erase(id);
+            gone.clear();
+        }
+        return count;
+    }
+
+    void ConnQueue::trimIdle() {
+        std::shared_lock lock(mut);
+        for(auto &[id, conn] : connections) {
+            conn->out_events.trim();
+            // in_events belongs to the I/O side.
+            if(conn->in_events.empty()) postTo(conn, &MudConnection::trim);
+        }
     }
 
     void ConnQueue::processOutEvents() {
         if(out_ready.empty()) {
             return;
         }
-        mut.lock();
-        std::unordered_set<uint32_t> deleted;
-        for(auto c : out_ready) {
-            for(auto e : c.second->out_events) {
-                switch(e.mtype) {
-                    case FromMudEvent::Disconnect:
-                        c.second->processFromMud(e);
-                        deleted.insert(c.first);
-                        break;
-                    default:
-                        c.second->processFromMud(e);
-                        break;
-                }
+        {
+            std::shared_lock lock(mut);
+            for(auto id : out_ready) {
+                auto found = connections.find(id);
+                if(found != connections.end()) postTo(found->second, &MudConnection::processOutbound);
             }
         }
-        for(auto d : deleted) {
-            in_ready.erase(d);
-            out_ready.erase(d);
-            auto conn = connections[d];
-            delete conn;
-            connections.erase(d);
-        }
-        mut.unlock();
+        out_ready.clear();
+    }
 
+    void ConnQueue::postTo(const std::shared_ptr<MudConnection> &conn, void (MudConnection::*fn)()) {
+        boost::asio::post(conn->exec, [conn, fn] {
+            if(conn->closed) return;
+            ((*conn).*fn)();
+        });
     }
 
 }
\ No newline at end of file
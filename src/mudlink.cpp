@@ -4,52 +4,132 @@
 
 #include "mudlink/mudlink.hpp"
 #include "mudlink/telnet.hpp"
+#include "mudlink/websocket.hpp"
 #include <iostream>
 
 namespace mudlink {
 
+    ListenerShard::ListenerShard(boost::asio::io_context &ctx) : context(ctx), acceptor(ctx) {
+
+    }
+
+    void ListenerShard::count(std::chrono::steady_clock::time_point now) {
+        auto second = std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count();
+        auto last = current_second.load(std::memory_order_relaxed);
+        if(second != last) {
+            last_count.store(second == last + 1 ? current_count.load(std::memory_order_relaxed) : 0,
+                             std::memory_order_relaxed);
+            current_count.store(0, std::memory_order_relaxed);
+            current_second.store(second, std::memory_order_relaxed);
+        }
+        current_count.fetch_add(1, std::memory_order_relaxed);
+        accepted.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t ListenerShard::acceptsPerSecond() const {
+        auto now = std::chrono::duration_cast<std::chrono::seconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        auto second = current_second.load(std::memory_order_relaxed);
+        if(now == second) return last_count.load(std::memory_order_relaxed);
+        if(now == second + 1) return current_count.load(std::memory_order_relaxed);
+        return 0;
+    }
+
     MudListener::MudListener(MudLink &lnk, std::string &name, ProtocolType type, boost::asio::ip::address &addr, uint16_t port,
-                             boost::asio::ssl::context *ssl_context)
-            : link(lnk), address(addr), cqueue(link.cqueue),
-              acceptor(link.cqueue.io_con, boost::asio::ip::tcp::endpoint(address, port)) {
+                             boost::asio::ssl::context *ssl_context, std::size_t shards, int backlog)
+            : link(lnk), cqueue(link.cqueue), ssl_con(ssl_context), address(addr) {
         this->name = name;
         this->ptype = type;
         this->port = port;
+        this->shard_count = shards;
+        this->backlog = backlog;
         running = false;
     }
 
+    void MudListener::openShard(boost::asio::io_context &ctx, bool reuse_port) {
+        auto shard = std::make_unique<ListenerShard>(ctx);
+        boost::asio::ip::tcp::endpoint endpoint(address, port);
+        auto &acceptor = shard->acceptor;
+        acceptor.open(endpoint.protocol());
+        acceptor.set_option(boost::asio::socket_base::reuse_address(true));
+        if(reuse_port) {
+#ifdef SO_REUSEPORT
+            acceptor.set_option(boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+#else
+            throw "SO_REUSEPORT is not supported on this platform";
+#endif
+        }
+        acceptor.bind(endpoint);
+        acceptor.listen(backlog);
+        shards.push_back(std::move(shard));
+    }
+
     void MudListener::start() {
         if(!running) {
             running = true;
-            listen();
+            if(shards.empty()) {
+                auto &pool = connectionPool();
+                if(shard_count == 1) {
+                    openShard(cqueue.io_con, false);
+                } else {
+                    auto count = shard_count ? shard_count : pool.size();
+                    for(std::size_t i = 0; i < count; i++) openShard(pool.get(i), true);
+                }
+            }
+            for(auto &s : shards) listen(*s);
         }
     }
 
+    IoPool& MudListener::connectionPool() {
+        return ssl_con && cqueue.tls_threads ? cqueue.tls_pool : cqueue.pool;
+    }
+
     void MudListener::stop() {
         if(running) {
             running = false;
         }
     }
 
-    void MudListener::listen() {
-        acceptor.async_accept([&](std::error_code ec, TcpSocket sock) {
+    void MudListener::listen(ListenerShard &shard) {
+        // Each accepted socket is bound to a fresh strand, so all of its handlers are serialized no
+        // matter how many threads run its context. A lone acceptor spreads them over the pool; a
+        // sharded one keeps them on its own thread.
+        //
+        // A socket waiting in an accept belongs to the acceptor's context, not the pool, so
+        // tearing down the pool first never leaves it bound to a destroyed strand.
+        shard.acceptor.async_accept(boost::asio::make_strand(shard.context), [this, &shard](std::error_code ec, TcpSocket sock) {
+
+            if(!ec && shards.size() == 1) {
+                auto protocol = sock.local_endpoint().protocol();
+                TcpSocket moved(boost::asio::make_strand(connectionPool().next()));
+                moved.assign(protocol, sock.release());
+                sock = std::move(moved);
+            }
 
             if(!ec) {
-                MudConnection *mud = nullptr;
+                shard.count(std::chrono::steady_clock::now());
+                boost::system::error_code addr_ec;
+                auto remote = sock.remote_endpoint(addr_ec);
+                std::shared_ptr<MudConnection> mud;
                 switch(ptype) {
                     case Telnet:
-                        mud = new telnet::TelnetConnection(cqueue, link.nextId++);
+                        mud = std::allocate_shared<telnet::TelnetConnection>(
+                                SlabAllocator<telnet::TelnetConnection>(cqueue.slab), cqueue, link.nextId++, std::move(sock));
                         break;
                     case WebSocket:
-                        //mud = new WebSocketMudConnection(cqueue, link.nextId++);
+                        mud = std::allocate_shared<websocket::WebSocketMudConnection>(
+                                SlabAllocator<websocket::WebSocketMudConnection>(cqueue.slab), cqueue, link.nextId++, std::move(sock));
                         break;
                 }
-                mud->address = sock.local_endpoint().address();
-                mud->conn.peer = new TcpSocket(std::move(sock));
-                mud->onConnect();
+                mud->scon = ssl_con;
+                mud->address = remote.address();
+                // A refused connection is simply dropped, closing its socket.
+                if(cqueue.add(mud)) {
+                    mud->onConnect();
+                }
             }
             if(running) {
-                listen();
+                listen(shard);
             }
         });
     }
@@ -59,7 +139,7 @@ namespace mudlink {
     }
 
     void MudLink::registerListener(std::string name, std::string address, uint16_t port, ProtocolType type,
-                                   std::optional<std::string> ssl_name) {
+                                   std::optional<std::string> ssl_name, std::size_t shards, int backlog) {
         if(listeners.contains(name)) {
             throw "duplicate server!";
         }
@@ -74,9 +154,9 @@ namespace mudlink {
             if(!ssl_contexts.contains(ssl_name.value())) {
                 throw "ssl context not found";
             }
-            con = ssl_contexts[ssl_name.value()];
+            con = &ssl_contexts[ssl_name.value()]->context;
         }
-        listeners[name] = new MudListener(*this, name, type, a, port, con);
+        listeners[name] = new MudListener(*this, name, type, a, port, con, shards, backlog);
 
     }
 
@@ -84,11 +164,16 @@ namespace mudlink {
         addresses.emplace(name, boost::asio::ip::make_address(addr));
     }
 
-    void MudLink::registerSSL(std::string name) {
-
+    void MudLink::registerSSL(std::string name, std::string cert_file, std::string key_file, TlsConfig config) {
+        if(ssl_contexts.contains(name)) {
+            throw "duplicate ssl context!";
+        }
+        ssl_contexts[name] = std::make_unique<TlsContext>(cert_file, key_file, config);
     }
 
     void MudLink::startListening() {
+        cqueue.pool.start(cqueue.io_threads);
+        if(cqueue.tls_threads) cqueue.tls_pool.start(cqueue.tls_threads);
         for(const auto & [k, v] : listeners) v->start();
     }
 
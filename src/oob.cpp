@@ -0,0 +1,170 @@
+#include "mudlink/oob.hpp"
+
+namespace mudlink {
+
+    void appendJsonString(std::string &out, std::string_view text) {
+        constexpr char hex[] = "0123456789abcdef";
+        for(auto c : text) {
+            switch(c) {
+                case '"': out.append("\\\""); break;
+                case '\\': out.append("\\\\"); break;
+                case '\n': out.append("\\n"); break;
+                case '\r': out.append("\\r"); break;
+                case '\t': out.append("\\t"); break;
+                default:
+                    if((uint8_t)c < 0x20) {
+                        out.append("\\u00");
+                        out.push_back(hex[(uint8_t)c >> 4]);
+                        out.push_back(hex[c & 15]);
+                    } else {
+                        out.push_back(c);
+                    }
+            }
+        }
+    }
+
+    namespace {
+
+        // Reads MSDP from the client, so nesting is limited.
+        struct MsdpReader {
+            static constexpr unsigned max_depth = 16;
+            std::string_view data;
+            std::size_t pos = 0;
+
+            bool at(MsdpCode c) {
+                if(pos < data.size() && (uint8_t)data[pos] == c) {
+                    pos++;
+                    return true;
+                }
+                return false;
+            }
+
+            // A name or plain value runs until the next MSDP code.
+            std::string_view text() {
+                auto start = pos;
+                while(pos < data.size() && (uint8_t)data[pos] > MSDP_ARRAY_CLOSE) pos++;
+                return data.substr(start, pos - start);
+            }
+
+            // The values after a name: none is an empty string, several an array.
+            bool values(std::string &out, unsigned depth) {
+                auto mark = out.size();
+                std::size_t count = 0;
+                while(at(MSDP_VAL)) {
+                    if(count++) out.push_back(',');
+                    if(!value(out, depth)) return false;
+                }
+                if(!count) {
+                    out.append("\"\"");
+                } else if(count > 1) {
+                    out.insert(mark, 1, '[');
+                    out.push_back(']');
+                }
+                return true;
+            }
+
+            bool value(std::string &out, unsigned depth) {
+                if(depth > max_depth) return false;
+                if(at(MSDP_TABLE_OPEN)) {
+                    out.push_back('{');
+                    while(at(MSDP_VAR)) {
+                        if(out.back() != '{') out.push_back(',');
+                        out.push_back('"');
+                        appendJsonString(out, text());
+                        out.append("\":");
+                        if(!values(out, depth + 1)) return false;
+                    }
+                    out.push_back('}');
+                    return at(MSDP_TABLE_CLOSE);
+                }
+                if(at(MSDP_ARRAY_OPEN)) {
+                    out.push_back('[');
+                    while(at(MSDP_VAL)) {
+                        if(out.back() != '[') out.push_back(',');
+                        if(!value(out, depth + 1)) return false;
+                    }
+                    out.push_back(']');
+                    return at(MSDP_ARRAY_CLOSE);
+                }
+                out.push_back('"');
+                appendJsonString(out, text());
+                out.push_back('"');
+                return true;
+            }
+        };
+
+    }
+
+    void decodeMsdp(std::string_view data, std::vector<OobMessage> &out) {
+        MsdpReader reader{data};
+        std::string json;
+        while(reader.at(MSDP_VAR)) {
+            auto name = reader.text();
+            json.clear();
+            if(name.empty() || !reader.values(json, 0)) return;
+            out.emplace_back(name, json);
+        }
+    }
+
+    std::string_view OobVars::key(std::string_view name) {
+        auto dot = name.rfind('.');
+        return dot == std::string_view::npos ? name : name.substr(dot + 1);
+    }
+
+    void OobVars::mark(Table::value_type &var) {
+        if(var.second.dirty) return;
+        var.second.dirty = true;
+        dirty.push_back(&var);
+    }
+
+    void OobVars::set(std::string_view name, std::string_view json) {
+        auto found = vars.find(name);
+        if(found == vars.end()) {
+            found = vars.emplace(std::string(name), Var()).first;
+        } else if(found->second.value == json) {
+            return;
+        }
+        found->second.value.assign(json);
+        mark(*found);
+    }
+
+    bool OobVars::command(const OobMessage &msg) {
+        auto cmd = msg.package();
+        if(cmd != "REPORT" && cmd != "UNREPORT" && cmd != "SEND") return false;
+        // decodeMsdp made the payload a name or an array of them. Turned back into MSDP, the names
+        // are whatever lies between the codes.
+        std::string names;
+        encodeMsdpValue(msg.payload(), [&](std::string_view run) { names.append(run); });
+        std::size_t start = 0;
+        for(std::size_t i = 0; i <= names.size(); i++) {
+            if(i < names.size() && (uint8_t)names[i] > MSDP_ARRAY_CLOSE) continue;
+            auto name = std::string_view(names).substr(start, i - start);
+            start = i + 1;
+            if(name.empty()) continue;
+            if(cmd == "UNREPORT") {
+                auto found = reported.find(name);
+                if(found != reported.end()) reported.erase(found);
+                continue;
+            }
+            // Either way the client gets the current value straight away. Names the game has never
+            // set aren't remembered, so a client can't grow reported without end.
+            bool known = false;
+            for(auto &var : vars) {
+                if(key(var.first) != name) continue;
+                known = true;
+                var.second.force = true;
+                mark(var);
+            }
+            if(known && cmd == "REPORT") reported.emplace(name);
+        }
+        return true;
+    }
+
+    void OobVars::resend() {
+        for(auto &var : vars) {
+            var.second.unsent = true;
+            mark(var);
+        }
+    }
+
+}
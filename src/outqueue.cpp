@@ -0,0 +1,105 @@
+#include "mudlink/outqueue.hpp"
+#include <algorithm>
+
+namespace mudlink {
+
+    std::string_view OutputQueue::Segment::view() const {
+        std::string_view out = shared ? std::string_view(*shared) : std::string_view(local);
+        return out.substr(offset);
+    }
+
+    PooledString& OutputQueue::addLocal(std::size_t len) {
+        auto &local = segments.emplace_back().local;
+        local.reserve(std::max(len, BufferPool::min_block - 1));
+        return local;
+    }
+
+    void OutputQueue::append(std::string_view data) {
+        if(data.empty()) return;
+        if(segments.size() - head <= in_flight || segments.back().shared) {
+            addLocal(data.size());
+        }
+        segments.back().local.append(data);
+        bytes += data.size();
+    }
+
+    void OutputQueue::append(SharedBuffer buf) {
+        if(!buf || buf->empty()) return;
+        bytes += buf->size();
+        segments.push_back(Segment{std::move(buf), PooledString(), 0});
+    }
+
+    char* OutputQueue::prepare(std::size_t len) {
+        if(segments.size() - head <= in_flight || segments.back().shared) {
+            addLocal(len);
+        }
+        auto &local = segments.back().local;
+        auto at = local.size();
+        local.resize(at + len);
+        reserved = len;
+        return local.data() + at;
+    }
+
+    void OutputQueue::commit(std::size_t len) {
+        auto &local = segments.back().local;
+        local.resize(local.size() - (reserved - len));
+        bytes += len;
+        reserved = 0;
+        if(local.empty()) segments.pop_back();
+        if(segments.size() == head) clear();
+    }
+
+    void OutputQueue::moveTo(OutputQueue &other) {
+        for(auto i = head; i < segments.size(); i++) {
+            other.segments.push_back(std::move(segments[i]));
+        }
+        other.bytes += bytes;
+        clear();
+    }
+
+    std::size_t OutputQueue::size() const {
+        return bytes;
+    }
+
+    bool OutputQueue::empty() const {
+        return bytes == 0;
+    }
+
+    std::size_t OutputQueue::gather(std::vector<boost::asio::const_buffer> &out, std::size_t max_segments) {
+        std::size_t count = 0;
+        for(auto i = head; i < segments.size() && count < max_segments; i++, count++) {
+            auto v = segments[i].view();
+            out.emplace_back(v.data(), v.size());
+        }
+        in_flight = count;
+        return count;
+    }
+
+    void OutputQueue::consume(std::size_t len) {
+        in_flight = 0;
+        bytes -= len;
+        while(len) {
+            auto &front = segments[head];
+            auto avail = front.view().size();
+            if(len < avail) {
+                front.offset += len;
+                break;
+            }
+            len -= avail;
+            front = Segment();
+            head++;
+        }
+        if(head == segments.size()) {
+            clear();
+        } else if(head >= 32 && head * 2 >= segments.size()) {
+            segments.erase(segments.begin(), segments.begin() + (std::ptrdiff_t)head);
+            head = 0;
+        }
+    }
+
+    void OutputQueue::clear() {
+        decltype(segments)().swap(segments);
+        head = bytes = in_flight = 0;
+    }
+
+}
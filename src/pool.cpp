@@ -0,0 +1,118 @@
+#include "mudlink/pool.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <new>
+
+namespace mudlink {
+
+    namespace {
+        constexpr std::size_t class_count = std::bit_width(BufferPool::max_block / BufferPool::min_block);
+
+        struct FreeBlock {
+            FreeBlock *next;
+        };
+
+        // One thread's cached blocks. Whatever is left is released when the thread exits.
+        struct BlockCache {
+            std::array<FreeBlock*, class_count> free{};
+            std::array<std::size_t, class_count> cached{};
+            ~BlockCache() {
+                for(std::size_t i = 0; i < class_count; i++) {
+                    while(auto block = free[i]) {
+                        free[i] = block->next;
+                        ::operator delete(block);
+                    }
+                }
+            }
+        };
+
+        thread_local BlockCache cache;
+
+        std::size_t classOf(std::size_t bytes) {
+            return std::bit_width((std::max(bytes, BufferPool::min_block) - 1) / BufferPool::min_block);
+        }
+    }
+
+    void* BufferPool::acquire(std::size_t &bytes) {
+        if(bytes > max_block) return ::operator new(bytes);
+        auto index = classOf(bytes);
+        bytes = min_block << index;
+        if(auto block = cache.free[index]) {
+            cache.free[index] = block->next;
+            cache.cached[index] -= bytes;
+            return block;
+        }
+        return ::operator new(bytes);
+    }
+
+    void BufferPool::release(void *ptr, std::size_t bytes) {
+        if(!ptr) return;
+        if(bytes > max_block) {
+            ::operator delete(ptr);
+            return;
+        }
+        auto index = classOf(bytes);
+        bytes = min_block << index;
+        if(cache.cached[index] + bytes > max_cached) {
+            ::operator delete(ptr);
+            return;
+        }
+        auto block = static_cast<FreeBlock*>(ptr);
+        block->next = cache.free[index];
+        cache.free[index] = block;
+        cache.cached[index] += bytes;
+    }
+
+    SlabPool::SlabPool(std::size_t objects_per_slab) : objects_per_slab(objects_per_slab) {
+
+    }
+
+    SlabPool::~SlabPool() {
+        for(auto [slab, align] : slabs) ::operator delete(slab, std::align_val_t(align));
+    }
+
+    SlabPool::SizeClass& SlabPool::classFor(std::size_t bytes, std::size_t align) {
+        align = std::max(align, alignof(std::max_align_t));
+        // Every object in a slab starts on an align boundary.
+        bytes = (std::max(bytes, sizeof(FreeNode)) + align - 1) & ~(align - 1);
+        auto found = std::find_if(classes.begin(), classes.end(), [&](auto &c) {
+            return c.size == bytes && c.align == align;
+        });
+        if(found != classes.end()) return *found;
+        return classes.emplace_back(SizeClass{bytes, align});
+    }
+
+    void* SlabPool::allocate(std::size_t bytes, std::size_t align) {
+        std::lock_guard lock(mut);
+        auto &c = classFor(bytes, align);
+        if(!c.free) {
+            // Out of this size; carve up a new slab.
+            auto slab = static_cast<char*>(::operator new(c.size * objects_per_slab, std::align_val_t(c.align)));
+            slabs.emplace_back(slab, c.align);
+            slab_bytes += c.size * objects_per_slab;
+            for(std::size_t i = objects_per_slab; i-- > 0;) {
+                auto node = reinterpret_cast<FreeNode*>(slab + i * c.size);
+                node->next = c.free;
+                c.free = node;
+            }
+        }
+        auto node = c.free;
+        c.free = node->next;
+        return node;
+    }
+
+    void SlabPool::deallocate(void *ptr, std::size_t bytes, std::size_t align) {
+        std::lock_guard lock(mut);
+        auto &c = classFor(bytes, align);
+        auto node = static_cast<FreeNode*>(ptr);
+        node->next = c.free;
+        c.free = node;
+    }
+
+    std::size_t SlabPool::reserved() const {
+        std::lock_guard lock(mut);
+        return slab_bytes;
+    }
+
+}
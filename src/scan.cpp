@@ -0,0 +1,100 @@
+#include "mudlink/scan.hpp"
+#include <array>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MUDLINK_SCAN_SSE2
+#endif
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define MUDLINK_SCAN_AVX2
+#endif
+
+namespace mudlink::scan {
+
+    namespace {
+        constexpr uint8_t IAC = 255, CR = 13, LF = 10, NUL = 0;
+
+        constexpr std::array<bool, 256> special = [] {
+            std::array<bool, 256> out{};
+            out[IAC] = out[CR] = out[LF] = out[NUL] = true;
+            return out;
+        }();
+
+        std::size_t scalar(const char *data, std::size_t len) {
+            for(std::size_t i = 0; i < len; i++) {
+                if(special[(uint8_t)data[i]]) return i;
+            }
+            return len;
+        }
+
+#ifdef MUDLINK_SCAN_SSE2
+        std::size_t sse2(const char *data, std::size_t len) {
+            const auto iac = _mm_set1_epi8((char)IAC), cr = _mm_set1_epi8((char)CR),
+                lf = _mm_set1_epi8((char)LF), nul = _mm_setzero_si128();
+            std::size_t i = 0;
+            for(; i + 16 <= len; i += 16) {
+                auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+                auto hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, iac), _mm_cmpeq_epi8(v, cr)),
+                                         _mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, nul)));
+                if(auto mask = (unsigned)_mm_movemask_epi8(hits)) return i + __builtin_ctz(mask);
+            }
+            return i + scalar(data + i, len - i);
+        }
+#endif
+
+#ifdef MUDLINK_SCAN_AVX2
+        __attribute__((target("avx2")))
+        std::size_t avx2(const char *data, std::size_t len) {
+            const auto iac = _mm256_set1_epi8((char)IAC), cr = _mm256_set1_epi8((char)CR),
+                lf = _mm256_set1_epi8((char)LF), nul = _mm256_setzero_si256();
+            std::size_t i = 0;
+            for(; i + 32 <= len; i += 32) {
+                auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+                auto hits = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, iac), _mm256_cmpeq_epi8(v, cr)),
+                                            _mm256_or_si256(_mm256_cmpeq_epi8(v, lf), _mm256_cmpeq_epi8(v, nul)));
+                if(auto mask = (unsigned)_mm256_movemask_epi8(hits)) return i + __builtin_ctz(mask);
+            }
+#ifdef MUDLINK_SCAN_SSE2
+            return i + sse2(data + i, len - i);
+#else
+            return i + scalar(data + i, len - i);
+#endif
+        }
+#endif
+
+        struct Kernel {
+            std::size_t (*fn)(const char*, std::size_t);
+            const char *name;
+        };
+
+        Kernel pick() {
+#ifdef MUDLINK_SCAN_AVX2
+            __builtin_cpu_init();
+            if(__builtin_cpu_supports("avx2")) return {avx2, "avx2"};
+#endif
+#ifdef MUDLINK_SCAN_SSE2
+            return {sse2, "sse2"};
+#else
+            return {scalar, "scalar"};
+#endif
+        }
+
+        const Kernel kernel = pick();
+    }
+
+    std::size_t findSpecial(std::string_view data) {
+        return kernel.fn(data.data(), data.size());
+    }
+
+    std::size_t findSpecialScalar(std::string_view data) {
+        return scalar(data.data(), data.size());
+    }
+
+    const char* kernelName() {
+        return kernel.name;
+    }
+
+}
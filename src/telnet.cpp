@@ -3,233 +3,343 @@
 //
 
 #include "mudlink/telnet.hpp"
+#include "mudlink/scan.hpp"
+#include <algorithm>
 
 namespace mudlink::telnet {
 
+    namespace {
+
+        // The opening handshake and the option state it leaves behind, worked out at compile time.
+        // MCCP2/MCCP3 are only offered while compression is enabled, hence a variant for each.
+        struct Startup {
+            std::array<char, 3 * (std::size(TelnetConnection::start_local) + std::size(TelnetConnection::start_remote))> bytes{};
+            std::size_t len = 0;
+            decltype(TelnetConnection::states) states{};
+            TelnetHandshakeHolder handshakes;
+        };
+
+        constexpr Startup makeStartup(bool compression) {
+            Startup out;
+            for(auto c : TelnetConnection::start_local) {
+                if((c == MCCP2 || c == MCCP3) && !compression) continue;
+                out.bytes[out.len++] = (char)IAC;
+                out.bytes[out.len++] = (char)WILL;
+                out.bytes[out.len++] = (char)c;
+                out.states[TelnetConnection::options[c].slot].local.negotiating = true;
+                out.handshakes.local |= TelnetConnection::handshakeBit(c);
+            }
+            for(auto c : TelnetConnection::start_remote) {
+                out.bytes[out.len++] = (char)IAC;
+                out.bytes[out.len++] = (char)DO;
+                out.bytes[out.len++] = (char)c;
+                out.states[TelnetConnection::options[c].slot].remote.negotiating = true;
+                out.handshakes.remote |= TelnetConnection::handshakeBit(c);
+            }
+            return out;
+        }
+
+        constexpr Startup startups[2] = {makeStartup(false), makeStartup(true)};
+
+        // Subnegotiation data still has its IACs doubled. Returns data itself if it has none.
+        std::string_view undoubleIac(std::string_view data, std::string &scratch) {
+            auto pos = data.find((char)IAC);
+            if(pos == std::string_view::npos) return data;
+            scratch.assign(data.substr(0, pos));
+            for(; pos < data.size(); pos++) {
+                scratch.push_back(data[pos]);
+                if((uint8_t)data[pos] == IAC) pos++;
+            }
+            return scratch;
+        }
+
+        // Whether text starts or ends with an upper-case affix, ignoring case.
+        bool matchNoCase(std::string_view text, std::string_view affix) {
+            if(text.size() != affix.size()) return false;
+            return std::equal(text.begin(), text.end(), affix.begin(), [](char a, char b) {
+                return (a >= 'a' && a <= 'z' ? (char)(a - 32) : a) == b;
+            });
+        }
+
+        bool startsNoCase(std::string_view text, std::string_view prefix) {
+            return matchNoCase(text.substr(0, prefix.size()), prefix);
+        }
+
+        bool endsNoCase(std::string_view text, std::string_view suffix) {
+            return text.size() >= suffix.size() && matchNoCase(text.substr(text.size() - suffix.size()), suffix);
+        }
+
+    }
+
     bool TelnetHandshakeHolder::empty() const {
-        return local.empty() && remote.empty() && special.empty();
+        return !(local | remote | special);
     }
 
     TelnetMessage::TelnetMessage(MessageType mt) {
         mtype = mt;
     }
 
-    std::optional<TelnetMessage> TelnetMessage::parse_bytes(boost::asio::streambuf &buf) {
-        auto box = buf.data();
+    std::size_t TelnetMessage::parse_one(std::string_view buf, TelnetMessage &out) {
         auto available = buf.size();
-        std::optional<TelnetMessage> out;
         if(available == 0) {
-            return out;
+            return 0;
         }
 
-        auto begin = boost::asio::buffers_begin(box), end = boost::asio::buffers_end(box);
-        // first, we read ahead
-        if((uint8_t)*begin == (uint8_t)TelnetCode::IAC) {
-            if(available < 2) {
-                // not enough bytes available - do nothing;
-                return out;
-            } else {
-                // we have 2 or more bytes!
-                auto b = begin;
-                b++;
-                if((uint8_t)*b == (uint8_t)TelnetCode::IAC) {
-                    // this is an escaped IAC.
-                    out.emplace(MessageType::Data);
-                    out.value().data.push_back(TelnetCode::IAC);
-                    buf.consume(2);
-                    return out;
-                } else {
-                    // It's not an escaped IAC...
-                    if(((uint8_t)*b == (uint8_t)TelnetCode::WILL) ||
-                       ((uint8_t)*b == (uint8_t)TelnetCode::WONT) ||
-                       ((uint8_t)*b == (uint8_t)TelnetCode::DO) ||
-                       ((uint8_t)*b == (uint8_t)TelnetCode::DONT)) {
-                        if(buf.size() > 2) {
-                            // IAC negotiation received.
-                            out.emplace(MessageType::Negotiation);
-                            out.value().option = (uint8_t)*b;
-                            out.value().extra = (uint8_t)*(++b);
-                            buf.consume(3);
-                            return out;
-                        } else {
-                            // It's negotiation, but we need more data.
-                            return out;
-                        }
-                    } else {
-                        // It's not a negotiation, so it's either a subnegotiation or a command.
-                        if((uint8_t)*b == (uint8_t)TelnetCode::SB) {
-                            // This is a subnegotiation. we will require at least 5 bytes for this to be usable.
-                            if(buf.size() >= 5) {
-                                uint8_t op = *(++b);
-                                auto sub = ++b;
-                                // we must seek ahead until we have an unescaped IAC SE. If we don't have one, do nothing.
-                                bool escaped = false, match1 = false, match2 = false;
-                                while(b != end) {
-                                    switch((uint8_t)*b) {
-                                        case TelnetCode::IAC:
-                                            if(match1) {
-                                                escaped = true;
-                                                match1 = false;
-                                            } else {
-                                                match1 = true;
-                                            }
-                                            break;
-                                        case TelnetCode::SE:
-                                            if(match1) {
-                                                match2 = true;
-                                            }
-                                            // we have a winner!;
-                                            b--;
-                                            out.emplace(MessageType::SubNegotiation);
-                                            out.value().option = op;
-                                            out.value().data.append(sub, b);
-                                            buf.consume(5 + out.value().data.size());
-                                            return out;
-                                    }
-                                }
-                            } else {
-                                // Not enough data. wait for more.
-                                return out;
-                            }
-                        } else {
-                            // Yeah, it's a command...
-                            out.emplace(MessageType::Command);
-                            out.value().option = (uint8_t)*b;
-                            buf.consume(2);
-                            return out;
-                        }
+        if((uint8_t)buf[0] != (uint8_t)TelnetCode::IAC) {
+            // Data begins on something that isn't an IAC. Scan ahead until we reach one, or the
+            // end of a line. Data runs therefore hold at most one LF, and only as their last byte,
+            // which spares receiveData from scanning them again.
+            out.mtype = MessageType::Data;
+            std::size_t pos = 0;
+            while(true) {
+                pos += scan::findSpecial(buf.substr(pos));
+                if(pos == available || (uint8_t)buf[pos] == (uint8_t)TelnetCode::IAC) break;
+                if((uint8_t)buf[pos++] == (uint8_t)TelnetCode::LF) break;
+                // CR or NUL, which only matter to the line splitter. Keep going.
+            }
+            out.data = buf.substr(0, pos);
+            return pos;
+        }
+
+        if(available < 2) {
+            // not enough bytes available - do nothing;
+            return 0;
+        }
+
+        auto b = (uint8_t)buf[1];
+        switch(b) {
+            case TelnetCode::IAC:
+                // this is an escaped IAC. The second byte is the data.
+                out.mtype = MessageType::Data;
+                out.data = buf.substr(1, 1);
+                return 2;
+            case TelnetCode::WILL:
+            case TelnetCode::WONT:
+            case TelnetCode::DO:
+            case TelnetCode::DONT:
+                // It's negotiation, but we might need more data.
+                if(available < 3) return 0;
+                out.mtype = MessageType::Negotiation;
+                out.option = b;
+                out.extra = (uint8_t)buf[2];
+                return 3;
+            case TelnetCode::SB: {
+                // This is a subnegotiation. we will require at least 5 bytes for this to be usable.
+                if(available < 5) return 0;
+                // we must seek ahead until we have an unescaped IAC SE. If we don't have one, do nothing.
+                for(std::size_t i = 3; i + 1 < available; i++) {
+                    if((uint8_t)buf[i] != (uint8_t)TelnetCode::IAC) continue;
+                    auto next = (uint8_t)buf[i + 1];
+                    if(next == TelnetCode::SE) {
+                        // we have a winner!
+                        out.mtype = MessageType::SubNegotiation;
+                        out.option = (uint8_t)buf[2];
+                        out.data = buf.substr(3, i - 3);
+                        return i + 2;
                     }
+                    // skip the second byte of an escaped IAC or other IAC pair.
+                    i++;
                 }
+                // Not enough data. wait for more.
+                return 0;
             }
-        } else {
-            // Data begins on something that isn't an IAC. Scan ahead until we reach one...
-            // Send all data up to an IAC, or everything if there is no IAC, as data.
-            out.emplace(MessageType::Data);
-            auto check = std::find(begin, end, TelnetCode::IAC);
-            out.value().data.append(begin, check);
-            buf.consume(out.value().data.size());
-            return out;
+            default:
+                // Yeah, it's a command...
+                out.mtype = MessageType::Command;
+                out.option = b;
+                return 2;
         }
-        return out;
     }
 
-    TelnetConnection::TelnetConnection(ConnQueue &cq, uint32_t id) : MudConnection(cq, id), timer(cq.io_con) {
+    std::size_t TelnetMessage::parse_bytes(std::string_view buf, std::vector<TelnetMessage> &out) {
+        return parse_bytes(buf, [&](TelnetMessage &msg) { out.push_back(msg); });
+    }
+
+    TelnetConnection::TelnetConnection(ConnQueue &cq, uint32_t id, TcpSocket sock)
+        : MudConnection(cq, id, std::move(sock)), cmdbuff(cq.max_line_length),
+          ready_timer(wheel, &onStrand<TelnetConnection, &TelnetConnection::finishReady>, this) {
+        cap.protocol = Telnet;
+        updateRenderClass();
+
+    }
+
+    void TelnetConnection::sendBytes(std::string_view data) {
+        outbox.append(data);
+    }
 
+    void TelnetConnection::sendBytes(SharedBuffer data) {
+        outbox.append(std::move(data));
     }
 
-    void TelnetConnection::sendBytes(std::string &data) {
-        auto a = outbox.prepare(data.size());
-        memcpy(a.data(), data.c_str(), data.size());
-        outbox.commit(data.size());
+    void TelnetConnection::sendText(std::string_view text) {
+        encodeText(text, RenderClass::unpack(render_class.load()), [&](std::string_view run) { outbox.append(run); });
         send();
     }
-    
-    void TelnetConnection::start() {
-        std::string data;
-        
-        for(auto c: supported) {
-            states.emplace(std::pair<uint8_t, TelnetOpState>(c, TelnetOpState{}));
-        }
-        
-        for(auto c : start_local) {
-            data.push_back(IAC);
-            data.push_back(WILL);
-            data.push_back(c);
-            states[c].local.negotiating = true;
-            handshakes.local.insert(c);
-        }
-        
-        for(auto c: start_remote) {
-            data.push_back(IAC);
-            data.push_back(DO);
-            data.push_back(c);
-            states[c].remote.negotiating = true;
-            handshakes.remote.insert(c);
+
+    SharedBuffer TelnetConnection::encodeMSSP(const MsspData &data) {
+        auto out = std::make_shared<std::string>();
+        out->push_back((char)IAC);
+        out->push_back((char)SB);
+        out->push_back((char)MSSP);
+        // Names and values come from the game and may hold 0xFF, which has to be doubled.
+        auto append = [&](std::string_view run) { out->append(run); };
+        for(const auto &[k, v] : data) {
+            out->push_back(1); // MSSP_VAR
+            escapeIac(k, append);
+            out->push_back(2); // MSSP_VAL
+            escapeIac(v, append);
         }
-        
-        sendBytes(data);
-        timer.expires_after(std::chrono::milliseconds(500));
-        timer.async_wait([&](std::error_code ec) {
-            finishReady();
-        });
+        out->push_back((char)IAC);
+        out->push_back((char)SE);
+        return out;
+    }
+
+    void TelnetConnection::start() {
+        // Every connection opens with the same offers, so the bytes are encoded once and shared.
+        static const SharedBuffer handshake[2] = {
+                std::make_shared<const std::string>(startups[0].bytes.data(), startups[0].len),
+                std::make_shared<const std::string>(startups[1].bytes.data(), startups[1].len)};
+        bool compression = cqueue.compression.enabled;
+        states = startups[compression].states;
+        handshakes = startups[compression].handshakes;
+        sendBytes(handshake[compression]);
+        send();
+        ready_timer.schedule(std::chrono::milliseconds(500));
     }
 
     void TelnetConnection::finishReady() {
         if(active) return;
         active = true;
+        ready_timer.cancel();
+        // Ready carries everything learned so far.
+        changed = false;
         if(!pending_events.empty()) {
-            in_mut.lock();
-            for(const auto& e : pending_events) {
-                in_events.push_back(e);
+            for(auto &e : pending_events) {
+                sendToMud(std::move(e));
             }
-            in_mut.unlock();
             pending_events.clear();
             pending_events.shrink_to_fit();
         }
 
-        MsgToMud m{ToMudEvent::Ready, 0};
-        sendToMud(m);
+        sendToMud(MsgToMud(ToMudEvent::Ready, std::make_shared<const Capabilities>(cap)));
     }
     
-    void TelnetConnection::sendSubNegotiate(TelnetCode op, std::string &data) {
-        std::string out;
-
-        out.push_back(IAC);
-        out.push_back(SB);
-        out.push_back(op);
-        out.append(data);
-        out.push_back(IAC);
-        out.push_back(SE);
-        
-        sendBytes(out);
+    void TelnetConnection::sendSubNegotiate(TelnetCode op, std::string_view data) {
+        const char head[] = {(char)IAC, (char)SB, (char)op}, tail[] = {(char)IAC, (char)SE};
+        outbox.append(std::string_view(head, sizeof(head)));
+        // IACs in the payload have to be doubled.
+        while(!data.empty()) {
+            auto pos = data.find((char)IAC);
+            if(pos == std::string_view::npos) {
+                outbox.append(data);
+                break;
+            }
+            outbox.append(data.substr(0, pos + 1));
+            outbox.append(data.substr(pos, 1));
+            data.remove_prefix(pos + 1);
+        }
+        outbox.append(std::string_view(tail, sizeof(tail)));
     }
 
     void TelnetConnection::onReceive() {
         while(true) {
-            auto m = TelnetMessage::parse_bytes(inbox);
-            if(m) {
-                processMessage(m.value());
-            } else {
-                break;
+            auto box = inbox.data();
+            std::string_view view(static_cast<const char*>(box.data()), box.size());
+            auto used = TelnetMessage::parse_bytes(view, [&](TelnetMessage &msg) {
+                processMessage(msg);
+                return !inflate_next;
+            });
+            inbox.consume(used);
+            if(!inflate_next) break;
+            // Everything after IAC SB MCCP3 IAC SE is compressed. Inflate it, then carry on parsing.
+            inflate_next = false;
+            if(!beginDecompression(std::move(mccp3))) break;
+        }
+
+        // However many options this read touched, the game hears of it once.
+        if(active) {
+            if(changed) {
+                changed = false;
+                sendToMud(MsgToMud(ToMudEvent::Update, std::make_shared<const Capabilities>(cap)));
             }
+        } else {
+            if(handshakes.empty()) finishReady();
         }
     }
 
-    void TelnetConnection::receiveData(std::string &data) {
-        // First, copy msg data to cmdbuff.
-        cmdbuff.append(data);
-
-        // Keep scanning cmdbuff for commands delimited by LF.
-        while(cmdbuff.size() > 0) {
-            auto begin = cmdbuff.begin();
-            auto end = cmdbuff.end();
-            auto check = std::find(begin, end, TelnetCode::LF);
-            // if there is no LF, we break the while loop. Perhaps next time this
-            // is called, we'll have an LF.
-            if(check == end) {
-                break;
-            }
-            // increment iterator to contain the LF.
-            check++;
+    void TelnetConnection::receiveData(std::string_view data) {
+        // The parser ends a data run after the first LF, so each run completes at most one command.
+        cmdbuff.push(data, [&](std::string_view cmd) {
+            sendToMud(MsgToMud(ToMudEvent::Command, std::string(cmd)));
+        });
+    }
 
-            // Copy the command and trim whitespace.
-            std::string cmd(begin, check);
-            boost::algorithm::trim(cmd);
+    void TelnetConnection::receiveCommand(uint8_t cmd) {
 
-            // remove the command from cmdbuff.
-            cmdbuff = std::string(check, end);
+    }
 
-            MsgToMud m{ToMudEvent::Ready, cmd};
-            sendToMud(m);
+    void TelnetConnection::processFromMud(MsgFromMud &&ev) {
+        // Pre-encoded output goes out untouched, whatever the event.
+        if(auto shared = std::get_if<SharedBuffer>(&ev.data)) {
+            sendBytes(std::move(*shared));
+            return;
         }
+        if(ev.mtype == FromMudEvent::MSSP) {
+            if(auto data = std::get_if<MsspData>(&ev.data)) sendBytes(encodeMSSP(*data));
+            return;
+        }
+        if(ev.mtype == FromMudEvent::OobVar) {
+            if(auto oob = std::get_if<OobMessage>(&ev.data)) oob_vars.set(oob->package(), oob->payload());
+            return;
+        }
+        encodeEvent(ev, RenderClass::unpack(render_class.load()), [&](std::string_view run) { outbox.append(run); });
     }
 
-    void TelnetConnection::receiveCommand(uint8_t cmd) {
+    void TelnetConnection::flushOob() {
+        auto rc = RenderClass::unpack(render_class.load());
+        auto emit = [&](std::string_view run) { escapeIac(run, [&](std::string_view r) { outbox.append(r); }); };
+        auto message = [&](bool start) {
+            const char sb[] = {(char)IAC, (char)SB, (char)(rc.oob == OobMSDP ? MSDP : GMCP)},
+                se[] = {(char)IAC, (char)SE};
+            outbox.append(start ? std::string_view(sb, 3) : std::string_view(se, 2));
+        };
+        oob_vars.flush(rc.oob, message, emit);
+    }
 
+    SharedBuffer TelnetConnection::encodeShared(const MsgFromMud &ev, RenderClass rc) const {
+        if(ev.mtype == FromMudEvent::MSSP) {
+            if(auto data = std::get_if<MsspData>(&ev.data)) return encodeMSSP(*data);
+            return nullptr;
+        }
+        auto out = std::make_shared<std::string>();
+        encodeEvent(ev, rc, [&](std::string_view run) { out->append(run); });
+        if(out->empty()) return nullptr;
+        return out;
+    }
+
+    void TelnetConnection::updateRenderClass() {
+        RenderClass rc;
+        rc.protocol = cap.protocol;
+        rc.color = cap.color;
+        rc.utf8 = cap.utf8;
+        rc.oob = cap.gmcp ? OobGMCP : cap.msdp ? OobMSDP : NoOob;
+        // Prompts are marked with EOR if the client asked for it, or GA unless it suppressed it.
+        if(opState(TELOPT_EOR).local.enabled) {
+            rc.prompt = PromptEOR;
+        } else if(!opState(SGA).local.enabled) {
+            rc.prompt = PromptGA;
+        }
+        render_class.store(rc.pack());
     }
 
-    void TelnetConnection::processFromMud(MsgFromMud &ev) {
+    void TelnetConnection::sendCommand(TelnetCode cmd) {
+        const char out[] = {(char)IAC, (char)cmd};
+        sendBytes(std::string_view(out, sizeof(out)));
+    }
 
+    void TelnetConnection::keepAlive() {
+        sendCommand(NOP);
+        send();
     }
 
     void TelnetConnection::processMessage(TelnetMessage &msg) {
@@ -249,54 +359,158 @@ namespace mudlink::telnet {
             default:
                 break;
         }
-
-        if(active) {
-            if(changed) {
-                changed = false;
-                MsgToMud m{ToMudEvent::Update, 0};
-                sendToMud(m);
-            }
-        } else {
-            if(handshakes.empty()) finishReady();
-        }
     }
 
 
 
     void TelnetConnection::sendNegotiation(TelnetCode neg, uint8_t op) {
-        std::string out;
-        out.push_back(IAC);
-        out.push_back(neg);
-        out.push_back(op);
-        sendBytes(out);
+        const char out[] = {(char)IAC, (char)neg, (char)op};
+        sendBytes(std::string_view(out, sizeof(out)));
     }
 
-    void TelnetConnection::receiveSubnegotiation(uint8_t op, std::string &data) {
+    void TelnetConnection::receiveSubnegotiation(uint8_t op, std::string_view data) {
         if(supportAny(op)) {
             auto code = (TelnetCode)op;
             switch(code) {
+                case MCCP3:
+                    if(mccp3 && !decompressor) inflate_next = true;
+                    break;
+                case MTTS:
+                    receiveTerminalType(data);
+                    break;
+                case NAWS:
+                    receiveWindowSize(data);
+                    break;
+                case GMCP: {
+                    if(!cap.gmcp) break;
+                    // Package, then optionally a space and the JSON payload. Both land in one
+                    // allocation in the OobMessage, straight from the input buffer unless IACs
+                    // had to be undoubled.
+                    std::string scratch;
+                    auto text = undoubleIac(data, scratch);
+                    auto space = text.find(' ');
+                    auto package = text.substr(0, space);
+                    std::string_view payload;
+                    if(space != std::string_view::npos) {
+                        payload = text.substr(space + 1);
+                        payload.remove_prefix(std::min(payload.find_first_not_of(' '), payload.size()));
+                    }
+                    if(!package.empty()) sendToMud(MsgToMud(ToMudEvent::OOB, OobMessage(package, payload)));
+                    break;
+                }
+                case MSDP: {
+                    if(!cap.msdp) break;
+                    // Handed to the game as if it were GMCP, a JSON payload per variable.
+                    std::string scratch;
+                    std::vector<OobMessage> vars;
+                    decodeMsdp(undoubleIac(data, scratch), vars);
+                    for(auto &var : vars) {
+                        // REPORT and the like are answered from oob_vars.
+                        if(oob_vars.command(var)) continue;
+                        sendToMud(MsgToMud(ToMudEvent::OOB, std::move(var)));
+                    }
+                    // Anything they asked for goes out with the reply rather than the next batch.
+                    flushOob();
+                    break;
+                }
                 default:
                     break;
             }
         }
     }
 
-    bool TelnetConnection::supportAny(uint8_t code) {
-        return std::find(std::begin(supported), std::end(supported), code) != std::end(supported);
+    void TelnetConnection::requestTerminalType() {
+        const char send_code[] = {1};
+        sendSubNegotiate(MTTS, std::string_view(send_code, 1));
+    }
+
+    void TelnetConnection::receiveTerminalType(std::string_view data) {
+        // IS and the answer, to a SEND of ours.
+        if(!(handshakes.special & handshakeBit(MTTS)) || data.empty() || data[0] != 0) return;
+        std::string scratch;
+        auto text = undoubleIac(data.substr(1), scratch);
+        if(mtts_round > 0 && text == mtts_last) {
+            endTerminalType();
+            return;
+        }
+
+        if(mtts_round == 0) {
+            auto space = text.find(' ');
+            cap.client_name.assign(text.substr(0, space));
+            cap.client_version.assign(space == std::string_view::npos ? std::string_view()
+                                                                      : text.substr(space + 1));
+        }
+        if(mtts_round < 2) {
+            // Clients without MTTS may answer with the terminal type first.
+            auto color = MudColor::None;
+            if(endsNoCase(text, "-TRUECOLOR") || endsNoCase(text, "-DIRECT")) {
+                color = MudColor::TrueColor;
+            } else if(endsNoCase(text, "-256COLOR") || startsNoCase(text, "XTERM")) {
+                color = MudColor::Xterm;
+            } else if(startsNoCase(text, "ANSI")) {
+                color = MudColor::Ansi;
+            }
+            cap.color = std::max(cap.color, color);
+            if(startsNoCase(text, "XTERM") || startsNoCase(text, "VT1")) cap.vt100 = true;
+        } else if(startsNoCase(text, "MTTS ")) {
+            uint32_t bits = 0;
+            for(auto c : text.substr(5)) {
+                if(c < '0' || c > '9') break;
+                bits = std::min(bits * 10 + (c - '0'), 0xFFFFu);
+            }
+            cap.mtts = true;
+            if(bits & 256) {
+                cap.color = MudColor::TrueColor;
+            } else if(bits & 8) {
+                cap.color = std::max(cap.color, MudColor::Xterm);
+            } else if(bits & 1) {
+                cap.color = std::max(cap.color, MudColor::Ansi);
+            }
+            cap.vt100 = bits & 2;
+            cap.utf8 = bits & 4;
+            cap.mouse_tracking = bits & 16;
+            cap.osc_color_palette = bits & 32;
+            cap.screen_reader = bits & 64;
+            cap.proxy = bits & 128;
+            cap.mnes = bits & 512;
+        }
+        changed = true;
+        updateRenderClass();
+
+        // Three answers are all MTTS has to give.
+        if(++mtts_round == 3) {
+            endTerminalType();
+            return;
+        }
+        mtts_last.assign(text);
+        requestTerminalType();
     }
 
-    bool TelnetConnection::supportLocal(uint8_t code) {
-        return std::find(std::begin(support_local), std::end(support_local), code) != std::end(support_local);
+    void TelnetConnection::endTerminalType() {
+        handshakes.special &= ~handshakeBit(MTTS);
+        mtts_last.clear();
     }
 
-    bool TelnetConnection::supportRemote(uint8_t code) {
-        return std::find(std::begin(support_remote), std::end(support_remote), code) != std::end(support_remote);
+    void TelnetConnection::receiveWindowSize(std::string_view data) {
+        // Undoubled as it's read; a 255 is sent as IAC IAC.
+        uint8_t bytes[4];
+        std::size_t n = 0;
+        for(std::size_t i = 0; i < data.size() && n < 4; i++) {
+            bytes[n++] = (uint8_t)data[i];
+            if((uint8_t)data[i] == IAC && i + 1 < data.size() && (uint8_t)data[i + 1] == IAC) i++;
+        }
+        if(n < 4) return;
+        uint16_t width = bytes[0] << 8 | bytes[1], height = bytes[2] << 8 | bytes[3];
+        if(width == cap.width && height == cap.height) return;
+        cap.width = width;
+        cap.height = height;
+        changed = true;
     }
 
     void TelnetConnection::receiveNegotiate(TelnetCode command, uint8_t op) {
         if(supportAny(op)) {
             auto code = (TelnetCode)op;
-            auto state = states[code];
+            auto &state = opState(code);
             switch(command) {
                 case TelnetCode::WILL:
                     if(supportRemote(code)) {
@@ -308,7 +522,7 @@ namespace mudlink::telnet {
                                 enableRemote(code);
                                 if(!state.remote.answered) {
                                     state.remote.answered = true;
-                                    handshakes.remote.erase(code);
+                                    handshakes.remote &= ~handshakeBit(code);
                                 }
                             }
                         } else {
@@ -317,7 +531,7 @@ namespace mudlink::telnet {
                             enableRemote(code);
                             if(!state.remote.answered) {
                                 state.remote.answered = true;
-                                handshakes.remote.erase(code);
+                                handshakes.remote &= ~handshakeBit(code);
                             }
                         }
                     } else {
@@ -333,7 +547,7 @@ namespace mudlink::telnet {
                                 enableLocal(code);
                                 if(!state.local.answered) {
                                     state.local.answered = true;
-                                    handshakes.local.erase(code);
+                                    handshakes.local &= ~handshakeBit(code);
                                 }
                             }
                         } else {
@@ -342,7 +556,7 @@ namespace mudlink::telnet {
                             enableLocal(code);
                             if(!state.local.answered) {
                                 state.local.answered = true;
-                                handshakes.local.erase(code);
+                                handshakes.local &= ~handshakeBit(code);
                             }
                         }
                     } else {
@@ -350,22 +564,28 @@ namespace mudlink::telnet {
                     }
                     break;
                 case TelnetCode::WONT:
-                    if(state.remote.enabled) disableRemote(code);
+                    if(state.remote.enabled) {
+                        state.remote.enabled = false;
+                        disableRemote(code);
+                    }
                     if(state.remote.negotiating) {
                         state.remote.negotiating = false;
                         if(!state.remote.answered) {
                             state.remote.answered = true;
-                            handshakes.remote.erase(code);
+                            handshakes.remote &= ~handshakeBit(code);
                         }
                     }
                     break;
                 case TelnetCode::DONT:
-                    if(state.local.enabled) disableLocal(code);
+                    if(state.local.enabled) {
+                        state.local.enabled = false;
+                        disableLocal(code);
+                    }
                     if(state.local.negotiating) {
                         state.local.negotiating = false;
                         if(!state.local.answered) {
                             state.local.answered = true;
-                            handshakes.local.erase(code);
+                            handshakes.local &= ~handshakeBit(code);
                         }
                     }
                     break;
@@ -377,19 +597,124 @@ namespace mudlink::telnet {
     }
     
     void TelnetConnection::enableLocal(TelnetCode op) {
-        
+        switch(op) {
+            case MSSP:
+                // The game answers with a FromMudEvent::MSSP.
+                sendToMud(MsgToMud(ToMudEvent::StatusReq));
+                break;
+            case SGA:
+            case TELOPT_EOR:
+                updateRenderClass();
+                break;
+            case GMCP:
+            case MSDP:
+                updateOob();
+                break;
+            case MCCP2: {
+                auto c = std::make_unique<Compressor>(cqueue.compression, cqueue.compression_budget, compress_stats);
+                if(!cqueue.compression.enabled || !c->start()) {
+                    // Out of memory budget, or turned off. Take it back.
+                    opState(MCCP2).local.enabled = false;
+                    sendNegotiation(WONT, MCCP2);
+                    break;
+                }
+                // Everything after IAC SB MCCP2 IAC SE is compressed.
+                sendSubNegotiate(MCCP2, {});
+                beginCompression(std::move(c));
+                cap.mccp2 = true;
+                break;
+            }
+            case MCCP3: {
+                // The stream is set up now so that a client over budget is turned down before it
+                // starts compressing.
+                auto d = std::make_unique<Decompressor>(cqueue.compression, cqueue.compression_budget, decompress_stats);
+                if(!cqueue.compression.enabled || !d->start()) {
+                    opState(MCCP3).local.enabled = false;
+                    sendNegotiation(WONT, MCCP3);
+                    break;
+                }
+                mccp3 = std::move(d);
+                cap.mccp3 = true;
+                break;
+            }
+            default:
+                break;
+        }
     }
 
     void TelnetConnection::enableRemote(TelnetCode op) {
-
+        switch(op) {
+            case MTTS:
+                // Ready waits for the cycle, or for ready_timer.
+                handshakes.special |= handshakeBit(MTTS);
+                mtts_round = 0;
+                requestTerminalType();
+                break;
+            case NAWS:
+                cap.naws = true;
+                changed = true;
+                break;
+            case GMCP:
+            case MSDP:
+                // Some clients offer these themselves rather than wait to be asked.
+                updateOob();
+                break;
+            default:
+                break;
+        }
     }
 
     void TelnetConnection::disableLocal(TelnetCode op) {
-
+        switch(op) {
+            case MCCP2:
+                endCompression();
+                cap.mccp2 = false;
+                break;
+            case MCCP3:
+                // A stream already running ends when the client finishes it.
+                mccp3.reset();
+                cap.mccp3 = false;
+                break;
+            case SGA:
+            case TELOPT_EOR:
+                updateRenderClass();
+                break;
+            case GMCP:
+            case MSDP:
+                updateOob();
+                break;
+            default:
+                break;
+        }
     }
 
     void TelnetConnection::disableRemote(TelnetCode op) {
+        switch(op) {
+            case MTTS:
+                endTerminalType();
+                break;
+            case NAWS:
+                cap.naws = false;
+                changed = true;
+                break;
+            case GMCP:
+            case MSDP:
+                updateOob();
+                break;
+            default:
+                break;
+        }
+    }
 
+    void TelnetConnection::updateOob() {
+        auto &gmcp = opState(GMCP), &msdp = opState(MSDP);
+        cap.gmcp = gmcp.local.enabled || gmcp.remote.enabled;
+        cap.msdp = msdp.local.enabled || msdp.remote.enabled;
+        cap.oob = cap.gmcp || cap.msdp;
+        if(cap.oob) oob_vars.resend();
+        // Until the connection is ready, the game learns of this with Ready.
+        if(active) changed = true;
+        updateRenderClass();
     }
     
 }
\ No newline at end of file
@@ -0,0 +1,152 @@
+#include "mudlink/timerwheel.hpp"
+#include <algorithm>
+#include <bit>
+
+namespace mudlink {
+
+    WheelTimer::WheelTimer(TimerWheel &wheel, Fire fire, void *owner) : wheel(wheel), fire(fire), owner(owner) {
+
+    }
+
+    WheelTimer::~WheelTimer() {
+        cancel();
+    }
+
+    void WheelTimer::schedule(std::chrono::milliseconds delay) {
+        wheel.schedule(*this, delay);
+    }
+
+    void WheelTimer::cancel() {
+        wheel.cancel(*this);
+    }
+
+    TimerWheel::TimerWheel(boost::asio::io_context &ctx, std::chrono::milliseconds tick)
+        : tick(tick), epoch(std::chrono::steady_clock::now()), timer(std::in_place, ctx) {
+
+    }
+
+    void TimerWheel::stop() {
+        std::lock_guard lock(mut);
+        timer.reset();
+        waiting = false;
+    }
+
+    std::size_t TimerWheel::size() const {
+        std::lock_guard lock(mut);
+        return count;
+    }
+
+    uint64_t TimerWheel::currentTick() const {
+        return (std::chrono::steady_clock::now() - epoch) / tick;
+    }
+
+    void TimerWheel::schedule(WheelTimer &t, std::chrono::milliseconds delay) {
+        std::lock_guard lock(mut);
+        unlink(t);
+        auto now = currentTick();
+        // Nothing has been processed while the wheel was idle, so skip ahead.
+        if(!count && !waiting) cursor = now;
+        // One extra tick, as now may be nearly over already.
+        t.due = std::max(now + (delay + tick - std::chrono::milliseconds(1)) / tick + 1, cursor);
+        link(t);
+        count++;
+        if(!waiting || nextTick() < wake) wait();
+    }
+
+    void TimerWheel::cancel(WheelTimer &t) {
+        std::lock_guard lock(mut);
+        unlink(t);
+    }
+
+    void TimerWheel::link(WheelTimer &t) {
+        auto delta = t.due - cursor;
+        unsigned level = 0;
+        while(level + 1 < levels && delta >= uint64_t(1) << (bits * (level + 1))) level++;
+        // Anything past the top level's reach waits in its furthest slot and is re-filed from there.
+        auto when = std::min(t.due, cursor + (uint64_t(1) << (bits * levels)) - 1);
+        auto slot = (when >> (bits * level)) & (slots - 1);
+        t.bucket = level * slots + slot;
+        auto &b = buckets[t.bucket];
+        t.prev = b.tail;
+        t.next = nullptr;
+        if(b.tail) b.tail->next = &t;
+        else b.head = &t;
+        b.tail = &t;
+        occupied[level] |= uint64_t(1) << slot;
+        t.linked = true;
+    }
+
+    void TimerWheel::unlink(WheelTimer &t) {
+        if(!t.linked) return;
+        auto &b = buckets[t.bucket];
+        if(t.prev) t.prev->next = t.next;
+        else b.head = t.next;
+        if(t.next) t.next->prev = t.prev;
+        else b.tail = t.prev;
+        if(!b.head) occupied[t.bucket / slots] &= ~(uint64_t(1) << (t.bucket % slots));
+        t.prev = t.next = nullptr;
+        t.linked = false;
+        count--;
+    }
+
+    void TimerWheel::cascade(unsigned level) {
+        auto slot = (cursor >> (bits * level)) & (slots - 1);
+        auto &b = buckets[level * slots + slot];
+        auto t = b.head;
+        b.head = b.tail = nullptr;
+        occupied[level] &= ~(uint64_t(1) << slot);
+        while(t) {
+            auto next = t->next;
+            link(*t);
+            t = next;
+        }
+    }
+
+    uint64_t TimerWheel::nextTick() const {
+        auto offset = cursor & (slots - 1);
+        // Wraps only matter while an upper level has something to bring down.
+        bool upper = std::any_of(occupied.begin() + 1, occupied.end(), [](uint64_t o) { return o != 0; });
+        if(upper && !offset) return cursor;
+        auto next = upper ? cursor - offset + slots : UINT64_MAX;
+        if(occupied[0]) next = std::min<uint64_t>(next, cursor + std::countr_zero(std::rotr(occupied[0], (int)offset)));
+        return next;
+    }
+
+    void TimerWheel::advance() {
+        auto now = currentTick();
+        while(count) {
+            // Ticks in between have nothing in them.
+            auto next = nextTick();
+            if(next > now) break;
+            cursor = next;
+            for(auto level = levels - 1; level > 0; level--) {
+                if(!(cursor & ((uint64_t(1) << (bits * level)) - 1))) cascade(level);
+            }
+            auto &b = buckets[cursor & (slots - 1)];
+            while(b.head) {
+                auto t = b.head;
+                unlink(*t);
+                t->fire(t->owner);
+            }
+            cursor++;
+        }
+        cursor = std::max(cursor, now + 1);
+    }
+
+    void TimerWheel::wait() {
+        if(!timer || !count) return;
+        waiting = true;
+        wake = nextTick();
+        // Replaces any wait already pending, whose handler then sees operation_aborted.
+        timer->expires_at(epoch + tick * static_cast<int64_t>(wake));
+        timer->async_wait([this](const boost::system::error_code &ec) {
+            if(ec == boost::asio::error::operation_aborted) return;
+            std::lock_guard lock(mut);
+            if(!timer) return;
+            waiting = false;
+            advance();
+            wait();
+        });
+    }
+
+}
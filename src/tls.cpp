@@ -0,0 +1,113 @@
+#include "mudlink/tls.hpp"
+#include <cstring>
+#include <openssl/core_names.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+namespace mudlink {
+
+    namespace {
+
+        // Where each SSL_CTX keeps its TlsContext. Not the app data: asio's context owns that,
+        // and deletes whatever is there as its own verify callback.
+        int contextIndex() {
+            static const int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+            return index;
+        }
+
+    }
+
+    TlsContext::TlsContext(const std::string &cert_file, const std::string &key_file, const TlsConfig &cfg)
+        : context(boost::asio::ssl::context::tls_server), config(cfg) {
+        context.set_options(boost::asio::ssl::context::default_workarounds | boost::asio::ssl::context::no_sslv2 |
+                            boost::asio::ssl::context::no_sslv3 | boost::asio::ssl::context::no_tlsv1 |
+                            boost::asio::ssl::context::no_tlsv1_1 | boost::asio::ssl::context::single_dh_use);
+        boost::system::error_code ec;
+        context.use_certificate_chain_file(cert_file, ec);
+        if(ec) throw "could not load certificate chain";
+        context.use_private_key_file(key_file, boost::asio::ssl::context::pem, ec);
+        if(ec) throw "could not load private key";
+
+        auto ctx = context.native_handle();
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(ctx, config.session_cache_size);
+        SSL_CTX_set_timeout(ctx, (long)config.session_timeout.count());
+        const unsigned char sid_ctx[] = "mudlink";
+        SSL_CTX_set_session_id_context(ctx, sid_ctx, sizeof(sid_ctx) - 1);
+
+        if(config.tickets) {
+            current_key = makeKey();
+            previous_key = makeKey();
+            if(contextIndex() < 0 || !SSL_CTX_set_ex_data(ctx, contextIndex(), this)) {
+                throw "could not set up session tickets";
+            }
+            SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, &TlsContext::ticketCallback);
+        } else {
+            SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+        }
+    }
+
+    TlsContext::TicketKey TlsContext::makeKey() {
+        TicketKey key;
+        if(RAND_bytes(key.name.data(), key.name.size()) != 1 || RAND_bytes(key.aes.data(), key.aes.size()) != 1 ||
+           RAND_bytes(key.hmac.data(), key.hmac.size()) != 1) {
+            throw "could not generate session ticket key";
+        }
+        key.created = std::chrono::steady_clock::now();
+        return key;
+    }
+
+    void TlsContext::keys(TicketKey &current, TicketKey &previous) {
+        std::lock_guard lock(key_mut);
+        auto age = std::chrono::steady_clock::now() - current_key.created;
+        if(age >= 2 * config.ticket_rotation) {
+            // Idle for over a period, so the current key has outlived its grace period as well.
+            previous_key = makeKey();
+            current_key = makeKey();
+        } else if(age >= config.ticket_rotation) {
+            previous_key = current_key;
+            current_key = makeKey();
+        }
+        current = current_key;
+        previous = previous_key;
+    }
+
+    int TlsContext::ticketCallback(SSL *ssl, unsigned char *key_name, unsigned char *iv, EVP_CIPHER_CTX *cctx,
+                                   EVP_MAC_CTX *hctx, int enc) {
+        auto self = static_cast<TlsContext*>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), contextIndex()));
+        TicketKey current, previous;
+        try {
+            self->keys(current, previous);
+        } catch(...) {
+            // No exceptions through OpenSSL. No ticket (or no resumption) this time.
+            return 0;
+        }
+
+        auto macKey = [&](TicketKey &key) {
+            char digest[] = "SHA256";
+            OSSL_PARAM params[] = {
+                    OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.hmac.data(), key.hmac.size()),
+                    OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+                    OSSL_PARAM_construct_end()};
+            return EVP_MAC_CTX_set_params(hctx, params) == 1;
+        };
+
+        if(enc) {
+            // Sealing a new ticket: always with the current key.
+            if(RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1) return -1;
+            std::memcpy(key_name, current.name.data(), current.name.size());
+            if(EVP_EncryptInit_ex(cctx, EVP_aes_256_cbc(), nullptr, current.aes.data(), iv) != 1) return -1;
+            return macKey(current) ? 1 : -1;
+        }
+
+        // Opening one: 1 if it's under the current key, 2 (accept, but issue a fresh ticket) if
+        // under the previous one, 0 to fall back to a full handshake.
+        for(auto [key, result] : {std::pair{&current, 1}, std::pair{&previous, 2}}) {
+            if(std::memcmp(key_name, key->name.data(), key->name.size()) != 0) continue;
+            if(EVP_DecryptInit_ex(cctx, EVP_aes_256_cbc(), nullptr, key->aes.data(), iv) != 1) return -1;
+            return macKey(*key) ? result : -1;
+        }
+        return 0;
+    }
+
+}
@@ -3,66 +3,202 @@
 //
 
 #include "mudlink/websocket.hpp"
+#include <algorithm>
 
 namespace mudlink::websocket {
-    // WebSocketMudConnection
-    WebSocketMudConnection::WebSocketMudConnection(MudListener &l, uint32_t id) : MudConnection(l, id) {};
 
-    void WebSocketMudConnection::onPlainConnect() {
-        auto old = conn.peer;
-        conn.websocket = new TcpWebSocket(std::move(*old));
-        wsock = true;
-        delete old;
-        conn.websocket->async_accept([&](std::error_code ec){
-            if(!ec) {
-                start();
-            }});
+    namespace ws = boost::beast::websocket;
+
+    WebSocketFrame::WebSocketFrame(bool binary) : binary(binary) {
+
     }
 
-    void WebSocketMudConnection::onSecureConnect() {
-        auto old = conn.secure_peer;
-        conn.tls_websocket = new TlsWebSocket(std::move(*old));
-        wsock = true;
-        delete old;
-        conn.tls_websocket->async_accept([&](std::error_code ec){
+    WebSocketMudConnection::WebSocketMudConnection(ConnQueue &cq, uint32_t id, TcpSocket sock)
+        : MudConnection(cq, id, std::move(sock)), cmdbuff(cq.max_line_length), inframe(cq.max_message_size) {
+        // Browsers render colour and UTF-8 themselves.
+        cap.protocol = WebSocket;
+        cap.color = TrueColor;
+        cap.utf8 = true;
+        updateRenderClass();
+    }
+
+    template<typename Next>
+    void WebSocketMudConnection::accept() {
+        auto next = std::move(std::get<Next>(transport));
+        auto &stream = transport.emplace<ws::stream<Next>>(std::move(next));
+        stream.set_option(ws::stream_base::timeout::suggested(boost::beast::role_type::server));
+        if(cqueue.compression.enabled) {
+            ws::permessage_deflate pmd;
+            pmd.server_enable = pmd.client_enable = true;
+            pmd.server_max_window_bits = std::clamp(cqueue.compression.window_bits, 9, 15);
+            pmd.compLevel = cqueue.compression.level;
+            pmd.memLevel = cqueue.compression.mem_level;
+            stream.set_option(pmd);
+        }
+        // Applies to the inflated size, so it also caps what a compressed message can expand to.
+        stream.read_message_max(cqueue.max_message_size);
+        stream.async_accept([this, self = shared_from_this()](std::error_code ec) {
             if(!ec) {
                 start();
-            }});
+                receive();
+            } else {
+                abort(ec.message());
+            }
+        });
     }
 
-    MudConnectionType WebSocketMudConnection::getType() {
-        return WebSocket;
+    void WebSocketMudConnection::onPlainConnect() {
+        accept<TcpSocket>();
+    }
+
+    void WebSocketMudConnection::onSecureConnect() {
+        accept<TlsSocket>();
     }
 
     void WebSocketMudConnection::start() {
-        std::cout << "websocket is running!" << std::endl;
+        // There is nothing to negotiate past the HTTP upgrade.
+        active = true;
+        sendToMud(MsgToMud(ToMudEvent::Ready, std::make_shared<const Capabilities>(cap)));
+    }
+
+    bool WebSocketMudConnection::isBinary(FromMudEvent mt) {
+        return mt == FromMudEvent::OobData || mt == FromMudEvent::MSSP;
+    }
+
+    OutputQueue& WebSocketMudConnection::frameFor(bool binary) {
+        if(binary || frames.empty() || frames.back().binary || (isWriting && frames.size() == 1)) {
+            frames.emplace_back(binary);
+        }
+        return frames.back().data;
     }
 
     void WebSocketMudConnection::send() {
-        if (!isWriting) {
-            if (outbox.size() > 0) {
-                isWriting = true;
-                // code here!
-            }
+        updateBacklog();
+        if(isWriting || closed) return;
+        if(frames.empty()) {
+            if(closing) closeStream();
+            return;
         }
+        auto &frame = frames.front();
+        isWriting = true;
+        write_bufs.clear();
+        frame.data.gather(write_bufs, SIZE_MAX);
+        auto handler = [this, self = shared_from_this()](std::error_code ec, std::size_t) {
+            frames.erase(frames.begin());
+            if(frames.empty()) decltype(frames)().swap(frames);
+            isWriting = false;
+            last_output = std::chrono::steady_clock::now();
+            if(!ec) {
+                send();
+            } else {
+                abort(ec.message());
+            }
+        };
+        std::visit([&](auto &stream) {
+            if constexpr(!isByteStream<std::decay_t<decltype(stream)>>) {
+                stream.binary(frame.binary);
+                stream.async_write(write_bufs, std::move(handler));
+            }
+        }, transport);
+    }
+
+    void WebSocketMudConnection::closeStream() {
+        // Sends a close frame and waits for the client's; the read loop sees that as closed.
+        std::visit([&](auto &stream) {
+            if constexpr(!isByteStream<std::decay_t<decltype(stream)>>) {
+                stream.async_close(ws::close_code::normal, [this, self = shared_from_this()](std::error_code) {
+                    close();
+                });
+            }
+        }, transport);
+    }
+
+    void WebSocketMudConnection::keepAlive() {
+        if(closing || pinging) return;
+        std::visit([&](auto &stream) {
+            if constexpr(!isByteStream<std::decay_t<decltype(stream)>>) {
+                if(!stream.is_open()) return;
+                pinging = true;
+                // A failed ping shows up in the read loop as well, so the result can be ignored.
+                stream.async_ping({}, [this, self = shared_from_this()](std::error_code) {
+                    pinging = false;
+                });
+            }
+        }, transport);
     }
 
     void WebSocketMudConnection::receive() {
-        auto handler = [&](std::error_code ec, std::size_t length){
-            if(!ec) {
-                std::cout << "Got some WebSocket bytes: " << length << std::endl;
-                onReceive();
-                receive();
+        if(closed || holdInput()) return;
+        auto handler = [this, self = shared_from_this()](boost::system::error_code ec, std::size_t) {
+            if(ec) {
+                abort(ec == ws::error::closed ? "connection closed" : ec.message());
+                return;
             }
+            noteInput();
+            onReceive();
+            receive();
         };
-        if(isTLS()) {
-            conn.tls_websocket->async_read(inbox, handler);
+        std::visit([&](auto &stream) {
+            if constexpr(!isByteStream<std::decay_t<decltype(stream)>>) stream.async_read(inframe, std::move(handler));
+        }, transport);
+    }
+
+    void WebSocketMudConnection::onReceive() {
+        auto binary = std::visit([](auto &stream) {
+            if constexpr(!isByteStream<std::decay_t<decltype(stream)>>) return stream.got_binary();
+            else return false;
+        }, transport);
+        auto box = inframe.cdata();
+        std::string_view data(static_cast<const char*>(box.data()), box.size());
+
+        if(binary) {
+            auto space = data.find(' ');
+            auto package = data.substr(0, space);
+            auto payload = space == std::string_view::npos ? std::string_view() : trimLine(data.substr(space + 1));
+            if(!package.empty()) sendToMud(MsgToMud(ToMudEvent::OOB, OobMessage(package, payload)));
         } else {
-            conn.websocket->async_read(inbox, handler);
+            auto cb = [&](std::string_view cmd) {
+                sendToMud(MsgToMud(ToMudEvent::Command, std::string(cmd)));
+            };
+            cmdbuff.feed(data, cb);
+            // The end of a message ends its last line too.
+            if(!data.empty() && data.back() != '\n') cmdbuff.push("\n", cb);
         }
+        inframe.consume(inframe.size());
+        inframe.shrink_to_fit();
     }
 
-    void WebSocketMudConnection::onReceive() {
+    void WebSocketMudConnection::processFromMud(MsgFromMud &&ev) {
+        auto binary = isBinary(ev.mtype);
+        if(auto shared = std::get_if<SharedBuffer>(&ev.data)) {
+            frameFor(binary).append(std::move(*shared));
+            return;
+        }
+        if(ev.mtype == FromMudEvent::OobVar) {
+            if(auto oob = std::get_if<OobMessage>(&ev.data)) oob_vars.set(oob->package(), oob->payload());
+            return;
+        }
+        auto &frame = frameFor(binary);
+        encodeEvent(ev, [&](std::string_view run) { frame.append(run); });
+    }
 
+    std::size_t WebSocketMudConnection::bufferedBytes() const {
+        std::size_t total = 0;
+        for(const auto &frame : frames) total += frame.data.size();
+        return total;
     }
-}
\ No newline at end of file
+
+    void WebSocketMudConnection::flushOob() {
+        OutputQueue *frame = nullptr;
+        oob_vars.flush(OobGMCP, [&](bool start) { if(start) frame = &frameFor(true); },
+                       [&](std::string_view run) { frame->append(run); });
+    }
+
+    SharedBuffer WebSocketMudConnection::encodeShared(const MsgFromMud &ev, RenderClass) const {
+        auto out = std::make_shared<std::string>();
+        encodeEvent(ev, [&](std::string_view run) { out->append(run); });
+        if(out->empty()) return nullptr;
+        return out;
+    }
+
+}
@@ -0,0 +1,76 @@
+#include <gtest/gtest.h>
+#include "loopback.hpp"
+
+using namespace mudlink;
+using namespace mudlink::test;
+
+namespace {
+
+    using TimePoint = std::chrono::steady_clock::time_point;
+
+    std::chrono::milliseconds between(TimePoint a, TimePoint b) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(b - a);
+    }
+
+    std::chrono::milliseconds since(TimePoint start) {
+        return between(start, std::chrono::steady_clock::now());
+    }
+
+}
+
+// A client that answers no offers and then goes quiet: it gets keepalives, is reported away,
+// comes back with a command, goes away again and is finally dropped. The connection's wheel
+// ticks every 50ms, so everything may be up to that late, plus scheduling slack.
+TEST(ActivityTimers, KeepaliveAfkAndIdle) {
+    LoopbackServer server([](ConnQueue &cq) {
+        cq.timers.keepalive = 300ms;
+        cq.timers.afk = 800ms;
+        cq.timers.idle = 1500ms;
+    });
+    auto start = std::chrono::steady_clock::now();
+    auto client = server.connect();
+
+    const char nop[] = {(char)telnet::IAC, (char)telnet::NOP};
+    auto got = LoopbackServer::readUntil(client, std::string_view(nop, 2), 1000ms);
+    ASSERT_NE(got.find(std::string_view(nop, 2)), std::string::npos);
+    EXPECT_GE(since(start), 250ms);
+
+    // Ready comes from the handshake timing out; away only counts from then on.
+    ASSERT_TRUE(server.waitFor(ToMudEvent::Ready));
+    auto afk = server.waitFor(ToMudEvent::Afk);
+    ASSERT_TRUE(afk);
+    EXPECT_GE(between(start, afk->at), 750ms);
+    EXPECT_LE(between(start, afk->at), 1500ms);
+
+    auto back = std::chrono::steady_clock::now();
+    LoopbackServer::write(client, "look\r\n");
+    auto cmd = server.waitFor([](const LoopbackServer::Event &e) {
+        auto text = std::get_if<std::string>(&e.msg.data);
+        return e.msg.mtype == ToMudEvent::Command && text && *text == "look";
+    });
+    ASSERT_TRUE(cmd);
+
+    // Away again, timed from the command.
+    afk = server.waitFor(ToMudEvent::Afk);
+    ASSERT_TRUE(afk);
+    EXPECT_GE(between(back, afk->at), 750ms);
+
+    auto gone = server.waitFor(ToMudEvent::Disconnected, 3000ms);
+    ASSERT_TRUE(gone);
+    EXPECT_GE(between(back, gone->at), 1450ms);
+    bool closed = false;
+    LoopbackServer::readUntil(client, "\n\n\n", 1000ms, &closed);
+    EXPECT_TRUE(closed);
+}
+
+// With no timers set, a quiet connection is left alone.
+TEST(ActivityTimers, OffByDefault) {
+    LoopbackServer server;
+    auto client = server.connect();
+    ASSERT_TRUE(server.waitFor(ToMudEvent::Ready));
+    EXPECT_FALSE(server.waitFor([](const LoopbackServer::Event &e) {
+        return e.msg.mtype == ToMudEvent::Afk || e.msg.mtype == ToMudEvent::Disconnected;
+    }, 1000ms));
+    auto got = LoopbackServer::readFor(client, 200ms);
+    EXPECT_EQ(got.find(std::string{(char)telnet::IAC, (char)telnet::NOP}), std::string::npos);
+}
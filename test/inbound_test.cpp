@@ -0,0 +1,46 @@
+#include <gtest/gtest.h>
+#include "loopback.hpp"
+
+using namespace mudlink;
+using namespace mudlink::test;
+
+// With the game not draining, the connection stops reading once its ring and one read's worth of
+// overflow are full, so the client's writes back up into TCP. Every command still arrives once the
+// game catches up.
+TEST(Inbound, StopsReadingWhileTheGameIsBehind) {
+    LoopbackServer server([](ConnQueue &cq) {
+        cq.event_capacity = 8;
+    });
+    auto client = server.connect();
+    client.set_option(boost::asio::socket_base::send_buffer_size(4096));
+    ASSERT_TRUE(server.waitFor(ToMudEvent::Ready));
+
+    // Long lines, so the game has fewer events to catch up on afterwards.
+    const std::string line = "say " + std::string(95, 'x') + "\n";
+    std::string chunk;
+    while(chunk.size() < 4000) chunk += line;
+    // Far more than the socket buffers hold, were the server reading it all.
+    constexpr std::size_t limit = 4 * 1024 * 1024;
+    std::size_t sent = 0;
+    auto blocked = std::chrono::steady_clock::now();
+    while(sent < limit && std::chrono::steady_clock::now() - blocked < 300ms) {
+        boost::system::error_code ec;
+        auto offset = sent % chunk.size();
+        auto n = client.write_some(boost::asio::buffer(chunk.data() + offset, chunk.size() - offset), ec);
+        if(ec == boost::asio::error::would_block) {
+            std::this_thread::sleep_for(5ms);
+            continue;
+        }
+        ASSERT_FALSE(ec) << ec.message();
+        sent += n;
+        blocked = std::chrono::steady_clock::now();
+    }
+    ASSERT_LT(sent, limit) << "the server kept reading";
+
+    // A line cut off at the end stays in the server's buffer.
+    std::size_t commands = 0;
+    auto last = server.waitFor([&](const LoopbackServer::Event &e) {
+        return e.msg.mtype == ToMudEvent::Command && ++commands == sent / line.size();
+    }, 10000ms);
+    EXPECT_TRUE(last) << commands << " of " << sent / line.size() << " commands arrived";
+}
@@ -0,0 +1,124 @@
+#ifndef MUDLINK_TEST_LOOPBACK_H
+#define MUDLINK_TEST_LOOPBACK_H
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "mudlink/mudlink.hpp"
+
+namespace mudlink::test {
+
+    using boost::asio::ip::tcp;
+    using namespace std::chrono_literals;
+
+    // A MudLink with one telnet listener on whatever loopback port the OS hands out, and clients to
+    // talk to it with. The acceptor runs on a thread of its own, connections on one I/O thread.
+    class LoopbackServer {
+    public:
+        struct Event {
+            uint32_t id;
+            MsgToMud msg;
+            std::chrono::steady_clock::time_point at;
+        };
+
+        // setup may adjust the ConnQueue before listening starts.
+        explicit LoopbackServer(const std::function<void(ConnQueue&)> &setup = {}) : cq(io), link(cq) {
+            cq.io_threads = 1;
+            cq.compression.enabled = false;
+            if(setup) setup(cq);
+            link.registerAddress("local", "127.0.0.1");
+            link.registerListener("telnet", "local", 0, ProtocolType::Telnet, std::nullopt);
+            link.startListening();
+            port = link.listeners.at("telnet")->shards.front()->acceptor.local_endpoint().port();
+            net = std::thread([this] { io.run(); });
+        }
+
+        ~LoopbackServer() {
+            link.stopListening();
+            io.stop();
+            net.join();
+        }
+
+        tcp::socket connect() {
+            tcp::socket s(client_io);
+            s.connect(tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), port));
+            s.non_blocking(true);
+            return s;
+        }
+
+        // Drains the game side until pred(event) holds for one, or timeout passes. Everything
+        // drained is kept in events. Returns the matching event, or null.
+        const Event* waitFor(const std::function<bool(const Event&)> &pred,
+                             std::chrono::milliseconds timeout = 2000ms) {
+            auto deadline = std::chrono::steady_clock::now() + timeout;
+            auto seen = events.size();
+            while(true) {
+                cq.drainInbound([&](uint32_t id, MsgToMud &&msg) {
+                    events.push_back(Event{id, std::move(msg), std::chrono::steady_clock::now()});
+                });
+                for(; seen < events.size(); seen++) {
+                    if(pred(events[seen])) return &events[seen];
+                }
+                if(std::chrono::steady_clock::now() >= deadline) return nullptr;
+                std::this_thread::sleep_for(5ms);
+            }
+        }
+
+        const Event* waitFor(ToMudEvent type, std::chrono::milliseconds timeout = 2000ms) {
+            return waitFor([type](const Event &e) { return e.msg.mtype == type; }, timeout);
+        }
+
+        // Queues ev for connection id and hands it to the I/O thread, as the game loop would.
+        void send(uint32_t id, MsgFromMud &&ev) {
+            cq.send(id, std::move(ev));
+            cq.processOutEvents();
+        }
+
+        static void write(tcp::socket &s, std::string_view data) {
+            boost::asio::write(s, boost::asio::buffer(data.data(), data.size()));
+        }
+
+        // Reads until what has arrived contains want, the server closes the connection (closed is
+        // set), or timeout passes.
+        static std::string readUntil(tcp::socket &s, std::string_view want, std::chrono::milliseconds timeout,
+                                     bool *closed = nullptr) {
+            std::string out;
+            char buf[4096];
+            auto deadline = std::chrono::steady_clock::now() + timeout;
+            if(closed) *closed = false;
+            while(out.find(want) == std::string::npos && std::chrono::steady_clock::now() < deadline) {
+                boost::system::error_code ec;
+                auto n = s.read_some(boost::asio::buffer(buf), ec);
+                if(ec == boost::asio::error::would_block) {
+                    std::this_thread::sleep_for(5ms);
+                    continue;
+                }
+                if(ec) {
+                    if(closed) *closed = true;
+                    break;
+                }
+                out.append(buf, n);
+            }
+            return out;
+        }
+
+        // Whatever arrives within wait.
+        static std::string readFor(tcp::socket &s, std::chrono::milliseconds wait) {
+            return readUntil(s, std::string_view("\0\0\0\0\0\0\0\0", 8), wait);
+        }
+
+        boost::asio::io_context io, client_io;
+        ConnQueue cq;
+        MudLink link;
+        uint16_t port = 0;
+        std::vector<Event> events;
+    private:
+        std::thread net;
+    };
+
+}
+
+#endif //MUDLINK_TEST_LOOPBACK_H
@@ -0,0 +1,134 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+#include "mudlink/oob.hpp"
+#include "loopback.hpp"
+
+using namespace mudlink;
+using namespace mudlink::test;
+
+namespace {
+
+    const std::string VAR = "\x01", VAL = "\x02", TABLE_OPEN = "\x03", TABLE_CLOSE = "\x04", ARRAY_OPEN = "\x05",
+            ARRAY_CLOSE = "\x06";
+
+    std::string encode(std::string_view json) {
+        std::string out;
+        encodeMsdpValue(json, [&](std::string_view run) { out.append(run); });
+        return out;
+    }
+
+    // Each variable's name and JSON.
+    using Vars = std::vector<std::pair<std::string, std::string>>;
+
+    Vars decode(std::string_view body) {
+        std::vector<OobMessage> msgs;
+        decodeMsdp(body, msgs);
+        Vars out;
+        for(auto &m : msgs) out.emplace_back(m.package(), m.payload());
+        return out;
+    }
+
+}
+
+TEST(Msdp, EncodesNestedTablesAndArrays) {
+    EXPECT_EQ(encode(R"({"hp":{"cur":10,"max":"20"},"list":["a",["b",true]],"e":[],"o":{}})"),
+              TABLE_OPEN + VAR + "hp" + VAL + TABLE_OPEN + VAR + "cur" + VAL + "10" + VAR + "max" + VAL + "20" +
+              TABLE_CLOSE + VAR + "list" + VAL + ARRAY_OPEN + VAL + "a" + VAL + ARRAY_OPEN + VAL + "b" + VAL +
+              "true" + ARRAY_CLOSE + ARRAY_CLOSE + VAR + "e" + VAL + ARRAY_OPEN + ARRAY_CLOSE + VAR + "o" + VAL +
+              TABLE_OPEN + TABLE_CLOSE + TABLE_CLOSE);
+    // Whitespace anywhere JSON allows it.
+    EXPECT_EQ(encode(" { \"a\" : [ 1 , \"x\" ] } "),
+              TABLE_OPEN + VAR + "a" + VAL + ARRAY_OPEN + VAL + "1" + VAL + "x" + ARRAY_CLOSE + TABLE_CLOSE);
+}
+
+TEST(Msdp, DecodesNestedTablesAndArrays) {
+    auto body = VAR + "x" + VAL + TABLE_OPEN + VAR + "hp" + VAL + TABLE_OPEN + VAR + "cur" + VAL + "10" + TABLE_CLOSE +
+                VAR + "list" + VAL + ARRAY_OPEN + VAL + "a" + VAL + ARRAY_OPEN + VAL + "b" + ARRAY_CLOSE + ARRAY_CLOSE +
+                VAR + "e" + VAL + ARRAY_OPEN + ARRAY_CLOSE + VAR + "o" + VAL + TABLE_OPEN + TABLE_CLOSE + TABLE_CLOSE;
+    EXPECT_EQ(decode(body), (Vars{{"x", R"({"hp":{"cur":"10"},"list":["a",["b"]],"e":[],"o":{}})"}}));
+}
+
+// MSDP has nothing but strings, so JSON made only of strings survives the trip unchanged.
+TEST(Msdp, RoundTrips) {
+    for(std::string json : {R"("plain")", R"({"a":"b"})", R"(["x",{"y":["z",[]]},{}])",
+                            R"({"k":"quote \" and \\ backslash","t":{"u":{"v":["w"]}}})"}) {
+        EXPECT_EQ(decode(VAR + "n" + VAL + encode(json)), (Vars{{"n", json}})) << json;
+    }
+}
+
+TEST(Msdp, UnicodeEscapes) {
+    EXPECT_EQ(encode(R"("café 😀")"), "caf\xc3\xa9 \xf0\x9f\x98\x80");
+    // A high surrogate with no low one is malformed, and the value is cut off there.
+    EXPECT_EQ(encode(R"("a\ud83db")"), "a");
+    EXPECT_EQ(encode(R"("a\ud83dA")"), "a");
+    // NUL and the MSDP codes themselves can't appear in a value.
+    EXPECT_EQ(encode(R"("a\u0000\u0001\u0006b\u0007")"), "ab\x07");
+    // UTF-8 from the client is passed through to the JSON as it is.
+    EXPECT_EQ(decode(VAR + "n" + VAL + "\xf0\x9f\x98\x80"), (Vars{{"n", "\"\xf0\x9f\x98\x80\""}}));
+}
+
+TEST(Msdp, NullIsAnEmptyValue) {
+    EXPECT_EQ(encode("null"), "");
+    EXPECT_EQ(encode(R"({"a":null,"b":[null]})"),
+              TABLE_OPEN + VAR + "a" + VAL + VAR + "b" + VAL + ARRAY_OPEN + VAL + ARRAY_CLOSE + TABLE_CLOSE);
+    EXPECT_EQ(decode(VAR + "n" + VAL + encode(R"({"a":null})")), (Vars{{"n", R"({"a":""})"}}));
+}
+
+TEST(Msdp, SeveralValuesMakeAnArray) {
+    EXPECT_EQ(decode(VAR + "x" + VAL + "1" + VAL + "2" + VAL + "3" + VAR + "y" + VAR + "z" + VAL + "only"),
+              (Vars{{"x", R"(["1","2","3"])"}, {"y", R"("")"}, {"z", R"("only")"}}));
+    // Inside a table too.
+    EXPECT_EQ(decode(VAR + "t" + VAL + TABLE_OPEN + VAR + "k" + VAL + "a" + VAL + "b" + TABLE_CLOSE),
+              (Vars{{"t", R"({"k":["a","b"]})"}}));
+}
+
+TEST(Msdp, MalformedInputIsTruncated) {
+    // Decoding stops at the first bad variable, keeping those before it.
+    EXPECT_EQ(decode(VAR + "a" + VAL + "1" + VAR + "b" + VAL + TABLE_OPEN + VAR + "c" + VAL + "2"),
+              (Vars{{"a", R"("1")"}}));
+    EXPECT_EQ(decode(VAR + "a" + VAL + ARRAY_OPEN + VAL + "1" + TABLE_CLOSE), Vars{});
+    EXPECT_EQ(decode(VAL + "1"), Vars{});
+    EXPECT_EQ(decode(VAR + VAL + "1"), Vars{});
+    EXPECT_EQ(decode(""), Vars{});
+    std::string deep = VAR + "d" + VAL;
+    for(int i = 0; i < 20; i++) deep += TABLE_OPEN + VAR + "k" + VAL;
+    EXPECT_EQ(decode(VAR + "a" + VAL + "1" + deep), (Vars{{"a", R"("1")"}}));
+
+    // Encoding stops where the JSON goes wrong.
+    EXPECT_EQ(encode(R"({"a":[1,2)"), TABLE_OPEN + VAR + "a" + VAL + ARRAY_OPEN + VAL + "1" + VAL + "2");
+    EXPECT_EQ(encode(R"({"a" 1})"), TABLE_OPEN + VAR + "a");
+    EXPECT_EQ(encode(R"("unterminated)"), "");
+    EXPECT_EQ(encode(R"("bad \u12)"), "bad ");
+    std::string nested(100, '[');
+    auto out = encode(nested);
+    EXPECT_LE(std::count(out.begin(), out.end(), ARRAY_OPEN[0]), 33);
+    // Something that isn't JSON at all goes out as a plain value.
+    EXPECT_EQ(encode("hello world"), "hello world");
+    EXPECT_EQ(encode("   "), "");
+}
+
+// IACs inside MSDP are doubled on the wire both ways, and the game never sees them doubled.
+TEST(Msdp, IacInPayloads) {
+    LoopbackServer server;
+    auto client = server.connect();
+    const char do_msdp[] = {(char)telnet::IAC, (char)telnet::DO, (char)telnet::MSDP};
+    LoopbackServer::write(client, std::string_view(do_msdp, 3));
+    auto ready = server.waitFor(ToMudEvent::Ready);
+    ASSERT_TRUE(ready);
+    LoopbackServer::readFor(client, 100ms);
+
+    server.send(ready->id, MsgFromMud(FromMudEvent::OobData, OobMessage("Room", "\"a\xff" "b\"")));
+    auto wire = "\xff\xfa\x45" + VAR + "Room" + VAL + "a\xff\xff" "b\xff\xf0";
+    EXPECT_NE(LoopbackServer::readUntil(client, wire, 1000ms).find(wire), std::string::npos);
+
+    LoopbackServer::write(client, "\xff\xfa\x45" + VAR + "name" + VAL + "x\xff\xff" "y\xff\xf0");
+    auto oob = server.waitFor(ToMudEvent::OOB);
+    ASSERT_TRUE(oob);
+    auto msg = std::get_if<OobMessage>(&oob->msg.data);
+    ASSERT_TRUE(msg);
+    EXPECT_EQ(msg->package(), "name");
+    EXPECT_EQ(msg->payload(), "\"x\xff" "y\"");
+}
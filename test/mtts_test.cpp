@@ -0,0 +1,133 @@
+#include <gtest/gtest.h>
+#include <string>
+#include "loopback.hpp"
+
+using namespace mudlink;
+using namespace mudlink::test;
+
+namespace {
+
+    std::string negotiate(telnet::TelnetCode cmd, telnet::TelnetCode op) {
+        return {(char)telnet::IAC, (char)cmd, (char)op};
+    }
+
+    std::string subnegotiate(telnet::TelnetCode op, std::string_view body) {
+        std::string out{(char)telnet::IAC, (char)telnet::SB, (char)op};
+        out.append(body);
+        out.push_back((char)telnet::IAC);
+        out.push_back((char)telnet::SE);
+        return out;
+    }
+
+    // IAC SB TTYPE IS text IAC SE.
+    std::string terminalType(std::string_view text) {
+        return subnegotiate(telnet::MTTS, std::string(1, '\0') + std::string(text));
+    }
+
+    const std::string ttype_send = subnegotiate(telnet::MTTS, "\x01");
+
+    const Capabilities& caps(const LoopbackServer::Event &e) {
+        return **std::get_if<SharedCapabilities>(&e.msg.data);
+    }
+
+    bool hasCaps(const LoopbackServer::Event &e) {
+        return std::holds_alternative<SharedCapabilities>(e.msg.data);
+    }
+
+}
+
+// The full MTTS cycle: name, terminal type, then the bits, with Ready held back until it's done.
+TEST(Mtts, ThreeRounds) {
+    LoopbackServer server;
+    auto client = server.connect();
+    LoopbackServer::write(client, negotiate(telnet::WILL, telnet::NAWS) + negotiate(telnet::WILL, telnet::MTTS) +
+                                  subnegotiate(telnet::NAWS, std::string("\x00\x50\x00\x18", 4)));
+    for(auto answer : {"MUDLET 4.17.2", "XTERM-256COLOR", "MTTS 325"}) {
+        auto got = LoopbackServer::readUntil(client, ttype_send, 1000ms);
+        ASSERT_NE(got.find(ttype_send), std::string::npos) << "no SEND before " << answer;
+        LoopbackServer::write(client, terminalType(answer));
+    }
+
+    auto ready = server.waitFor(ToMudEvent::Ready);
+    ASSERT_TRUE(ready && hasCaps(*ready));
+    auto &cap = caps(*ready);
+    EXPECT_EQ(cap.client_name, "MUDLET");
+    EXPECT_EQ(cap.client_version, "4.17.2");
+    EXPECT_TRUE(cap.mtts);
+    // 325 = ANSI | UTF-8 | SCREEN READER | TRUECOLOR. The bits have the last word on vt100.
+    EXPECT_EQ(cap.color, MudColor::TrueColor);
+    EXPECT_TRUE(cap.utf8);
+    EXPECT_TRUE(cap.screen_reader);
+    EXPECT_FALSE(cap.vt100);
+    EXPECT_FALSE(cap.mouse_tracking);
+    EXPECT_TRUE(cap.naws);
+    EXPECT_EQ(cap.width, 80);
+    EXPECT_EQ(cap.height, 24);
+
+    // Three answers end the cycle: no fourth SEND, and a late answer changes nothing.
+    EXPECT_EQ(LoopbackServer::readFor(client, 200ms).find(ttype_send), std::string::npos);
+    LoopbackServer::write(client, terminalType("OTHER"));
+    EXPECT_FALSE(server.waitFor(ToMudEvent::Update, 300ms));
+}
+
+// A client without MTTS repeats its terminal type, which ends the cycle early.
+TEST(Mtts, RepeatEndsTheCycle) {
+    LoopbackServer server;
+    auto client = server.connect();
+    LoopbackServer::write(client, negotiate(telnet::WILL, telnet::MTTS) + negotiate(telnet::WONT, telnet::NAWS));
+    for(int i = 0; i < 2; i++) {
+        auto got = LoopbackServer::readUntil(client, ttype_send, 1000ms);
+        ASSERT_NE(got.find(ttype_send), std::string::npos);
+        LoopbackServer::write(client, terminalType("xterm-256color"));
+    }
+    auto ready = server.waitFor(ToMudEvent::Ready);
+    ASSERT_TRUE(ready && hasCaps(*ready));
+    auto &cap = caps(*ready);
+    EXPECT_EQ(cap.client_name, "xterm-256color");
+    EXPECT_EQ(cap.color, MudColor::Xterm);
+    EXPECT_TRUE(cap.vt100);
+    EXPECT_FALSE(cap.mtts);
+    EXPECT_FALSE(cap.utf8);
+    EXPECT_FALSE(cap.naws);
+    EXPECT_EQ(LoopbackServer::readFor(client, 200ms).find(ttype_send), std::string::npos);
+}
+
+// Answers nobody asked for are ignored.
+TEST(Mtts, UnaskedAnswersIgnored) {
+    LoopbackServer server;
+    auto client = server.connect();
+    LoopbackServer::write(client, terminalType("MUDLET") + subnegotiate(telnet::MTTS, "\x01"));
+    auto ready = server.waitFor(ToMudEvent::Ready);
+    ASSERT_TRUE(ready && hasCaps(*ready));
+    EXPECT_EQ(caps(*ready).client_name, "");
+}
+
+TEST(Naws, OneUpdatePerBatch) {
+    LoopbackServer server;
+    auto client = server.connect();
+    LoopbackServer::write(client, negotiate(telnet::WILL, telnet::NAWS) + negotiate(telnet::WONT, telnet::MTTS));
+    auto ready = server.waitFor(ToMudEvent::Ready);
+    ASSERT_TRUE(ready && hasCaps(*ready));
+    EXPECT_TRUE(caps(*ready).naws);
+    EXPECT_EQ(caps(*ready).width, 0);
+
+    // Two resizes in one write: one Update, with the last size. 255 has its IAC doubled.
+    LoopbackServer::write(client, subnegotiate(telnet::NAWS, std::string("\x00\x78\x00\x28", 4)) +
+                                  subnegotiate(telnet::NAWS, std::string("\x00\xff\xff\x01\x00", 5)));
+    auto update = server.waitFor(ToMudEvent::Update);
+    ASSERT_TRUE(update && hasCaps(*update));
+    EXPECT_EQ(caps(*update).width, 255);
+    EXPECT_EQ(caps(*update).height, 256);
+    EXPECT_FALSE(server.waitFor(ToMudEvent::Update, 300ms));
+
+    // The same size again, or a short one, is no change.
+    LoopbackServer::write(client, subnegotiate(telnet::NAWS, std::string("\x00\xff\xff\x01\x00", 5)) +
+                                  subnegotiate(telnet::NAWS, std::string("\x00\x10\x00", 3)));
+    EXPECT_FALSE(server.waitFor(ToMudEvent::Update, 300ms));
+
+    // Turning NAWS off is.
+    LoopbackServer::write(client, negotiate(telnet::WONT, telnet::NAWS));
+    update = server.waitFor(ToMudEvent::Update);
+    ASSERT_TRUE(update && hasCaps(*update));
+    EXPECT_FALSE(caps(*update).naws);
+}
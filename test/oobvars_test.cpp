@@ -0,0 +1,127 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include "mudlink/oob.hpp"
+
+using namespace mudlink;
+
+namespace {
+
+    const std::string VAR = "\x01", VAL = "\x02", TABLE_OPEN = "\x03", TABLE_CLOSE = "\x04";
+
+    using Messages = std::vector<std::string>;
+
+    // One string per GMCP message or MSDP subnegotiation body.
+    Messages flush(OobVars &vars, OobMode mode) {
+        Messages out;
+        bool open = false;
+        vars.flush(mode, [&](bool start) {
+            EXPECT_NE(start, open) << "messages must not nest or close twice";
+            open = start;
+            if(start) out.emplace_back();
+        }, [&](std::string_view run) {
+            EXPECT_TRUE(open) << "output outside a message";
+            if(open) out.back().append(run);
+        });
+        EXPECT_FALSE(open) << "message left open";
+        return out;
+    }
+
+}
+
+TEST(OobVars, GmcpGroupsByPackageWithLastValues) {
+    OobVars vars;
+    vars.set("Room.Info.name", R"("Hall")");
+    vars.set("Char.Vitals.mp", "5");
+    vars.set("Char.Vitals.hp", "10");
+    vars.set("Char.Vitals.hp", "9");
+    vars.set("Char.Status.level", "3");
+    EXPECT_EQ(flush(vars, OobGMCP), (Messages{R"(Char.Status {"level":3})", R"(Char.Vitals {"hp":9,"mp":5})",
+                                              R"(Room.Info {"name":"Hall"})"}));
+}
+
+// A subpackage sorts between its parent's keys by full name, but mustn't split the parent's message.
+TEST(OobVars, GmcpSubpackagesDontSplitAPackage) {
+    OobVars vars;
+    vars.set("Char.mp", "5");
+    vars.set("Char.info.lvl", "3");
+    vars.set("Char.hp", "9");
+    EXPECT_EQ(flush(vars, OobGMCP), (Messages{R"(Char {"hp":9,"mp":5})", R"(Char.info {"lvl":3})"}));
+}
+
+TEST(OobVars, OnlyChangesGoOut) {
+    OobVars vars;
+    vars.set("Char.Vitals.hp", "10");
+    vars.set("Char.Vitals.mp", "5");
+    flush(vars, OobGMCP);
+    EXPECT_TRUE(flush(vars, OobGMCP).empty());
+
+    // Set to what the client already has, or changed and changed back, is no change.
+    vars.set("Char.Vitals.mp", "5");
+    vars.set("Char.Vitals.hp", "11");
+    vars.set("Char.Vitals.hp", "10");
+    EXPECT_TRUE(flush(vars, OobGMCP).empty());
+
+    vars.set("Char.Vitals.hp", "8");
+    EXPECT_EQ(flush(vars, OobGMCP), (Messages{R"(Char.Vitals {"hp":8})"}));
+
+    // Everything goes again after resend, as it would to a client that just turned GMCP on.
+    vars.resend();
+    EXPECT_EQ(flush(vars, OobGMCP), (Messages{R"(Char.Vitals {"hp":8,"mp":5})"}));
+}
+
+TEST(OobVars, NamesWithoutAPackage) {
+    OobVars vars;
+    vars.set("Ping", R"({"t":1})");
+    vars.set("Empty", "");
+    vars.set("Char.Vitals.hp", "");
+    EXPECT_EQ(flush(vars, OobGMCP), (Messages{"Empty ", R"(Ping {"t":1})", R"(Char.Vitals {"hp":null})"}));
+}
+
+TEST(OobVars, NothingWithoutOob) {
+    OobVars vars;
+    vars.set("Char.Vitals.hp", "10");
+    EXPECT_TRUE(flush(vars, NoOob).empty());
+    // Still pending for when the client does speak it.
+    EXPECT_EQ(flush(vars, OobGMCP), (Messages{R"(Char.Vitals {"hp":10})"}));
+}
+
+TEST(OobVars, MsdpSendsReportedKeysInOneSubnegotiation) {
+    OobVars vars;
+    vars.set("Char.Vitals.hp", "10");
+    vars.set("Char.Vitals.mp", "5");
+    vars.set("Room.Info.name", R"({"short":"Hall"})");
+    EXPECT_TRUE(flush(vars, OobMSDP).empty());
+
+    // REPORT sends the current values straight away.
+    EXPECT_TRUE(vars.command(OobMessage("REPORT", R"(["hp","name"])")));
+    EXPECT_EQ(flush(vars, OobMSDP), (Messages{VAR + "hp" + VAL + "10" + VAR + "name" + VAL + TABLE_OPEN + VAR +
+                                              "short" + VAL + "Hall" + TABLE_CLOSE}));
+
+    vars.set("Char.Vitals.hp", "9");
+    vars.set("Char.Vitals.mp", "4");
+    EXPECT_EQ(flush(vars, OobMSDP), (Messages{VAR + "hp" + VAL + "9"}));
+
+    // SEND is a one-off, even for unreported keys.
+    EXPECT_TRUE(vars.command(OobMessage("SEND", R"("mp")")));
+    EXPECT_EQ(flush(vars, OobMSDP), (Messages{VAR + "mp" + VAL + "4"}));
+    vars.set("Char.Vitals.mp", "3");
+    EXPECT_TRUE(flush(vars, OobMSDP).empty());
+
+    EXPECT_TRUE(vars.command(OobMessage("UNREPORT", R"("hp")")));
+    vars.set("Char.Vitals.hp", "1");
+    EXPECT_TRUE(flush(vars, OobMSDP).empty());
+
+    EXPECT_FALSE(vars.command(OobMessage("LIST", R"("COMMANDS")")));
+}
+
+TEST(OobVars, MsdpIgnoresReportsOfUnsetNames) {
+    OobVars vars;
+    EXPECT_TRUE(vars.command(OobMessage("REPORT", R"(["hp","nope"])")));
+    EXPECT_TRUE(flush(vars, OobMSDP).empty());
+    // Not remembered, so it doesn't start going out once set.
+    vars.set("Char.Vitals.hp", "10");
+    EXPECT_TRUE(flush(vars, OobMSDP).empty());
+    EXPECT_TRUE(vars.command(OobMessage("REPORT", R"("hp")")));
+    EXPECT_EQ(flush(vars, OobMSDP), (Messages{VAR + "hp" + VAL + "10"}));
+}
@@ -0,0 +1,188 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include <vector>
+#include "mudlink/timerwheel.hpp"
+
+using namespace mudlink;
+
+namespace mudlink::test {
+
+    class TimerWheelAccess {
+    public:
+        // Moves the wheel's clock on by d at once and fires whatever falls due, as though d had passed.
+        static void skip(TimerWheel &wheel, std::chrono::milliseconds d) {
+            std::lock_guard lock(wheel.mut);
+            wheel.epoch -= d;
+            wheel.advance();
+            wheel.wait();
+        }
+    };
+
+}
+
+namespace {
+
+    // Long enough that real time never moves the wheel on by itself; advanceTo() does it all. Short
+    // enough that a few times the wheel's whole range still fits steady_clock's nanoseconds.
+    constexpr std::chrono::milliseconds tick = std::chrono::minutes(1);
+    // Ticks spanned by each level, and by the whole wheel.
+    constexpr uint64_t level1 = 64, level2 = 64 * 64, level3 = 64 * 64 * 64, range = level3 * 64;
+
+    struct Probe {
+        Probe(TimerWheel &wheel, std::vector<int> &fired, int id)
+            : fired(fired), id(id), timer(wheel, &Probe::fire, this) {}
+        static void fire(void *owner) {
+            auto self = static_cast<Probe*>(owner);
+            self->fired.push_back(self->id);
+        }
+        std::vector<int> &fired;
+        int id;
+        WheelTimer timer;
+    };
+
+    class TimerWheelTest : public ::testing::Test {
+    protected:
+        ~TimerWheelTest() override {
+            wheel.stop();
+        }
+
+        static std::chrono::milliseconds ticks(uint64_t n) {
+            return tick * static_cast<int64_t>(n);
+        }
+
+        // Moves the clock on to n ticks after the wheel was made.
+        void advanceTo(uint64_t n) {
+            ASSERT_GE(n, now);
+            test::TimerWheelAccess::skip(wheel, ticks(n - now));
+            now = n;
+        }
+
+        boost::asio::io_context ctx;
+        TimerWheel wheel{ctx, tick};
+        std::vector<int> fired;
+        uint64_t now = 0;
+    };
+
+}
+
+// Armed at the start of tick 0, a delay of n ticks is due at tick n + 1: the tick arming
+// happens in may be nearly over.
+TEST_F(TimerWheelTest, FiresInDueOrderThenArmOrder) {
+    Probe a(wheel, fired, 1), b(wheel, fired, 2), c(wheel, fired, 3);
+    a.timer.schedule(ticks(5));
+    b.timer.schedule(ticks(3));
+    c.timer.schedule(ticks(5));
+    EXPECT_EQ(wheel.size(), 3u);
+    advanceTo(3);
+    EXPECT_TRUE(fired.empty());
+    advanceTo(4);
+    EXPECT_EQ(fired, (std::vector<int>{2}));
+    advanceTo(5);
+    EXPECT_EQ(fired, (std::vector<int>{2}));
+    advanceTo(6);
+    EXPECT_EQ(fired, (std::vector<int>{2, 1, 3}));
+    EXPECT_EQ(wheel.size(), 0u);
+}
+
+TEST_F(TimerWheelTest, CancelAndRearm) {
+    Probe a(wheel, fired, 1), b(wheel, fired, 2);
+    a.timer.schedule(ticks(2));
+    b.timer.schedule(ticks(2));
+    b.timer.cancel();
+    b.timer.cancel();
+    EXPECT_EQ(wheel.size(), 1u);
+
+    // Re-arming replaces the old deadline, later or earlier.
+    a.timer.schedule(ticks(10));
+    EXPECT_EQ(wheel.size(), 1u);
+    advanceTo(5);
+    EXPECT_TRUE(fired.empty());
+    a.timer.schedule(ticks(1));
+    advanceTo(6);
+    EXPECT_TRUE(fired.empty());
+    advanceTo(7);
+    EXPECT_EQ(fired, (std::vector<int>{1}));
+    advanceTo(20);
+    EXPECT_EQ(fired, (std::vector<int>{1}));
+
+    a.timer.cancel();
+    EXPECT_EQ(wheel.size(), 0u);
+    b.timer.schedule(ticks(3));
+    advanceTo(24);
+    EXPECT_EQ(fired, (std::vector<int>{1, 2}));
+}
+
+TEST_F(TimerWheelTest, CancelInsideAnUpperLevel) {
+    Probe a(wheel, fired, 1), b(wheel, fired, 2);
+    a.timer.schedule(ticks(level2 + 10));
+    b.timer.schedule(ticks(level2 + 10));
+    a.timer.cancel();
+    advanceTo(level2 + 11);
+    EXPECT_EQ(fired, (std::vector<int>{2}));
+    EXPECT_EQ(wheel.size(), 0u);
+}
+
+// Timers either side of every level boundary cascade down and fire exactly when due.
+TEST_F(TimerWheelTest, LevelBoundaries) {
+    const std::vector<uint64_t> delays = {1, level1 - 2, level1 - 1, level1, level1 + 1, 2 * level1 - 1,
+                                          2 * level1, level2 - 1, level2, level2 + 1, level3 - 1, level3,
+                                          level3 + 1, 5 * level3 + 17};
+    std::vector<std::unique_ptr<Probe>> probes;
+    // Armed longest first, so arm order can't be what puts them in order.
+    for(auto i = delays.size(); i-- > 0;) {
+        probes.push_back(std::make_unique<Probe>(wheel, fired, (int)i));
+        probes.back()->timer.schedule(ticks(delays[i]));
+    }
+    for(std::size_t i = 0; i < delays.size(); i++) {
+        advanceTo(delays[i]);
+        ASSERT_EQ(fired.size(), i) << "delay " << delays[i] << " fired early";
+        advanceTo(delays[i] + 1);
+        ASSERT_EQ(fired.size(), i + 1) << "delay " << delays[i] << " fired late";
+        EXPECT_EQ(fired.back(), (int)i);
+    }
+}
+
+// Past the top level's reach, a timer waits in its furthest slot and is re-filed from there.
+TEST_F(TimerWheelTest, BeyondTheTopLevel) {
+    Probe near(wheel, fired, 1), far(wheel, fired, 2), farther(wheel, fired, 3);
+    near.timer.schedule(ticks(range - 2));
+    far.timer.schedule(ticks(range + 1000));
+    farther.timer.schedule(ticks(2 * range + 5));
+    advanceTo(range - 1);
+    EXPECT_EQ(fired, (std::vector<int>{1}));
+    advanceTo(range + 1000);
+    EXPECT_EQ(fired, (std::vector<int>{1}));
+    advanceTo(range + 1001);
+    EXPECT_EQ(fired, (std::vector<int>{1, 2}));
+    advanceTo(2 * range + 5);
+    EXPECT_EQ(fired, (std::vector<int>{1, 2}));
+    advanceTo(2 * range + 6);
+    EXPECT_EQ(fired, (std::vector<int>{1, 2, 3}));
+}
+
+// After a stall, everything overdue fires in order in one go, and timers armed afterwards are
+// timed from the present rather than from where the wheel had got to.
+TEST_F(TimerWheelTest, CatchesUpAfterAStall) {
+    Probe a(wheel, fired, 1), b(wheel, fired, 2), c(wheel, fired, 3), d(wheel, fired, 4);
+    c.timer.schedule(ticks(level2 + 3));
+    b.timer.schedule(ticks(100));
+    a.timer.schedule(ticks(10));
+    advanceTo(10000);
+    EXPECT_EQ(fired, (std::vector<int>{1, 2, 3}));
+    d.timer.schedule(ticks(1));
+    advanceTo(10001);
+    EXPECT_EQ(fired.size(), 3u);
+    advanceTo(10002);
+    EXPECT_EQ(fired, (std::vector<int>{1, 2, 3, 4}));
+}
+
+TEST_F(TimerWheelTest, SkipsEmptyTicksCheaply) {
+    // Nothing armed: a long stretch of time is a no-op, and the next timer still lands right.
+    advanceTo(range * 4);
+    Probe a(wheel, fired, 1);
+    a.timer.schedule(ticks(level1 * 3));
+    advanceTo(range * 4 + level1 * 3);
+    EXPECT_TRUE(fired.empty());
+    advanceTo(range * 4 + level1 * 3 + 1);
+    EXPECT_EQ(fired, (std::vector<int>{1}));
+}